@@ -0,0 +1,78 @@
+#include "counters/CountersBackpressure.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <thread>
+#include <utility>
+
+#include "counters/CountersMetrics.h"
+#include "folly/Format.h"
+#include "gflags/gflags.h"
+#include "glog/logging.h"
+#include "rocksdb/options.h"
+
+DEFINE_double(counters_backpressure_threshold, 0.5,
+              "Consumers slow down once compaction debt reaches this fraction of RocksDB's write slowdown triggers");
+DEFINE_int64(counters_backpressure_min_delay_ms, 50, "Initial delay between consumer batches under backpressure");
+DEFINE_int64(counters_backpressure_max_delay_ms, 10000, "Maximum delay between consumer batches under backpressure");
+
+namespace counters {
+
+CountersBackpressure::CountersBackpressure(std::string consumerName, rocksdb::DB* db,
+                                           CountersGroupCommit::Participant* participant)
+    : consumerName_(std::move(consumerName)), db_(db), participant_(participant), delayMs_(0) {}
+
+void CountersBackpressure::throttle(const std::function<bool()>& shouldRun) {
+  double currentPressure = pressure();
+  int64_t prevDelayMs = delayMs_;
+  if (currentPressure >= FLAGS_counters_backpressure_threshold) {
+    delayMs_ = std::min(std::max(delayMs_ * 2, FLAGS_counters_backpressure_min_delay_ms),
+                        FLAGS_counters_backpressure_max_delay_ms);
+  } else {
+    delayMs_ = delayMs_ / 2 < FLAGS_counters_backpressure_min_delay_ms ? 0 : delayMs_ / 2;
+  }
+  CountersMetrics::set(folly::sformat("backpressure.pressure_pct.{}", consumerName_),
+                       static_cast<int64_t>(currentPressure * 100));
+  CountersMetrics::set(folly::sformat("backpressure.delay_ms.{}", consumerName_), delayMs_);
+  if (delayMs_ > 0 && prevDelayMs == 0) {
+    LOG(INFO) << "Consumer `" << consumerName_ << "` slowing down under compaction pressure " << currentPressure;
+  } else if (delayMs_ == 0 && prevDelayMs > 0) {
+    LOG(INFO) << "Consumer `" << consumerName_ << "` no longer under compaction pressure";
+  }
+
+  if (delayMs_ == 0) return;
+  // other consumers committing meanwhile should not wait for this one
+  CountersGroupCommit::Idle idle(participant_);
+  auto until = std::chrono::steady_clock::now() + std::chrono::milliseconds(delayMs_);
+  while (std::chrono::steady_clock::now() < until && shouldRun()) {
+    std::this_thread::sleep_for(std::min(std::chrono::duration_cast<std::chrono::milliseconds>(
+                                             until - std::chrono::steady_clock::now()),
+                                         std::chrono::milliseconds(100)));
+  }
+}
+
+double CountersBackpressure::pressure() {
+  if (db_ == nullptr) return 0.0;
+
+  uint64_t value = 0;
+  if ((db_->GetIntProperty("rocksdb.is-write-stopped", &value) && value > 0) ||
+      (db_->GetIntProperty("rocksdb.actual-delayed-write-rate", &value) && value > 0)) {
+    // RocksDB is stalling writes already
+    return 1.0;
+  }
+
+  rocksdb::Options options = db_->GetOptions();
+  double result = 0.0;
+  std::string numFiles;
+  if (options.level0_slowdown_writes_trigger > 0 && db_->GetProperty("rocksdb.num-files-at-level0", &numFiles)) {
+    result = std::max(result, std::strtod(numFiles.c_str(), nullptr) / options.level0_slowdown_writes_trigger);
+  }
+  if (options.soft_pending_compaction_bytes_limit > 0 &&
+      db_->GetIntProperty("rocksdb.estimate-pending-compaction-bytes", &value)) {
+    result = std::max(result, static_cast<double>(value) / options.soft_pending_compaction_bytes_limit);
+  }
+  return result;
+}
+
+}  // namespace counters
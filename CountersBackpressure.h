@@ -0,0 +1,47 @@
+#ifndef COUNTERS_COUNTERSBACKPRESSURE_H_
+#define COUNTERS_COUNTERSBACKPRESSURE_H_
+
+#include <functional>
+#include <string>
+
+#include "counters/CountersGroupCommit.h"
+#include "rocksdb/db.h"
+
+namespace counters {
+
+// Slows down background ingestion while compaction falls behind, well before RocksDB itself stalls writes.
+// Consumers absorb the slowdown so that interactive writes from the redis handler keep a predictable latency.
+class CountersBackpressure {
+ public:
+  // db may be null, in which case there is never any backpressure. The consumer's group commit participant, if any,
+  // is idle while it sleeps.
+  CountersBackpressure(std::string consumerName, rocksdb::DB* db,
+                       CountersGroupCommit::Participant* participant = nullptr);
+  virtual ~CountersBackpressure() {}
+
+  // Sleep before the next batch for as long as compaction pressure calls for, or until shouldRun returns false.
+  // The delay backs off exponentially while pressure persists and decays once compaction catches up.
+  void throttle(const std::function<bool()>& shouldRun);
+
+  int64_t delayMs() const {
+    return delayMs_;
+  }
+
+ protected:
+  // Compaction debt relative to the points where RocksDB starts slowing writes down, 1.0 meaning it is about to.
+  // L0 files are measured against the live slowdown trigger, which catch-up mode relaxes together with the
+  // compaction trigger, so that a replay is not held back before compactions are even scheduled. Pending compaction
+  // bytes, which catch-up mode leaves alone, still guard against the debt such a replay builds up.
+  virtual double pressure();
+
+ private:
+
+  const std::string consumerName_;
+  rocksdb::DB* const db_;
+  CountersGroupCommit::Participant* const participant_;
+  int64_t delayMs_;
+};
+
+}  // namespace counters
+
+#endif  // COUNTERS_COUNTERSBACKPRESSURE_H_
@@ -0,0 +1,114 @@
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "counters/CountersBackpressure.h"
+#include "counters/CountersCatchUpMode.h"
+#include "counters/CountersHandler.h"
+#include "folly/Conv.h"
+#include "gflags/gflags.h"
+#include "gtest/gtest.h"
+#include "rocksdb/options.h"
+#include "stesting/TestWithRocksDb.h"
+
+DECLARE_double(counters_backpressure_threshold);
+DECLARE_int64(counters_backpressure_min_delay_ms);
+DECLARE_int64(counters_backpressure_max_delay_ms);
+DECLARE_int64(counters_catch_up_enter_lag_ms);
+DECLARE_int64(counters_catch_up_exit_lag_ms);
+DECLARE_int32(counters_catch_up_compaction_factor);
+
+namespace counters {
+
+// Reports a pressure set by the test instead of reading it from a database
+class FakeCountersBackpressure : public CountersBackpressure {
+ public:
+  FakeCountersBackpressure() : CountersBackpressure("consumer1", nullptr), pressure_(0.0) {}
+
+  double pressure_;
+
+ protected:
+  double pressure() override {
+    return pressure_;
+  }
+};
+
+class CountersBackpressureTest : public ::testing::Test {
+ protected:
+  CountersBackpressureTest() {
+    FLAGS_counters_backpressure_threshold = 0.5;
+    FLAGS_counters_backpressure_min_delay_ms = 1;
+    FLAGS_counters_backpressure_max_delay_ms = 8;
+  }
+
+  // Throttle once for each pressure and return the delays applied
+  static std::vector<int64_t> throttle(FakeCountersBackpressure* backpressure, double pressure, int times) {
+    std::vector<int64_t> delays;
+    backpressure->pressure_ = pressure;
+    for (int i = 0; i < times; i++) {
+      backpressure->throttle([]() { return true; });
+      delays.push_back(backpressure->delayMs());
+    }
+    return delays;
+  }
+};
+
+TEST_F(CountersBackpressureTest, BacksOffAndDecays) {
+  FakeCountersBackpressure backpressure;
+  EXPECT_EQ(std::vector<int64_t>({ 0, 0 }), throttle(&backpressure, 0.4, 2));
+  // doubles from the minimum up to the maximum while pressure persists
+  EXPECT_EQ(std::vector<int64_t>({ 1, 2, 4, 8, 8 }), throttle(&backpressure, 0.5, 5));
+  // and halves once it is gone, until it drops below the minimum
+  EXPECT_EQ(std::vector<int64_t>({ 4, 2, 1, 0 }), throttle(&backpressure, 0.0, 4));
+}
+
+TEST_F(CountersBackpressureTest, StopsSleepingWhenStopped) {
+  FLAGS_counters_backpressure_min_delay_ms = 60 * 1000;
+  FLAGS_counters_backpressure_max_delay_ms = 60 * 1000;
+  FakeCountersBackpressure backpressure;
+  backpressure.pressure_ = 1.0;
+
+  auto start = std::chrono::steady_clock::now();
+  backpressure.throttle([]() { return false; });
+  EXPECT_EQ(60 * 1000, backpressure.delayMs());
+  EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(1));
+}
+
+class CountersBackpressureDbTest : public stesting::TestWithRocksDb {
+ protected:
+  CountersBackpressureDbTest()
+    : stesting::TestWithRocksDb({}, {{"default", CountersHandler::optimizeColumnFamily}}) {
+    FLAGS_counters_backpressure_threshold = 0.5;
+    FLAGS_counters_backpressure_min_delay_ms = 1;
+    FLAGS_counters_backpressure_max_delay_ms = 8;
+    FLAGS_counters_catch_up_enter_lag_ms = 1000;
+    FLAGS_counters_catch_up_exit_lag_ms = 100;
+    FLAGS_counters_catch_up_compaction_factor = 4;
+  }
+};
+
+TEST_F(CountersBackpressureDbTest, RelaxedTriggersDuringCatchUp) {
+  ASSERT_TRUE(db()->SetOptions({
+                                   {"level0_file_num_compaction_trigger", "4"},
+                                   {"level0_slowdown_writes_trigger", "20"},
+                                   {"level0_stop_writes_trigger", "36"},
+                               })
+                  .ok());
+  CountersCatchUpMode catchUp("consumer1", db());
+  ASSERT_TRUE(catchUp.update(2000));
+
+  // half of the configured slowdown trigger, but well below the relaxed compaction trigger of 16
+  for (int i = 0; i < 10; i++) {
+    db()->Put(rocksdb::WriteOptions(), "key" + folly::to<std::string>(i), "1");
+    ASSERT_TRUE(db()->Flush(rocksdb::FlushOptions()).ok());
+  }
+  std::string numFiles;
+  ASSERT_TRUE(db()->GetProperty("rocksdb.num-files-at-level0", &numFiles));
+  ASSERT_EQ("10", numFiles);
+
+  CountersBackpressure backpressure("consumer1", db());
+  backpressure.throttle([]() { return true; });
+  EXPECT_EQ(0, backpressure.delayMs());
+}
+
+}  // namespace counters
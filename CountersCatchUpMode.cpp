@@ -0,0 +1,100 @@
+#include "counters/CountersCatchUpMode.h"
+
+#include <chrono>
+#include <utility>
+
+#include "counters/CountersMetrics.h"
+#include "folly/Conv.h"
+#include "folly/Format.h"
+#include "gflags/gflags.h"
+#include "glog/logging.h"
+#include "rocksdb/options.h"
+
+DEFINE_int64(counters_catch_up_enter_lag_ms, 10 * 60 * 1000,
+             "Consumers lagging behind by more than this switch to catch-up mode; 0 disables catch-up mode");
+DEFINE_int64(counters_catch_up_exit_lag_ms, 60 * 1000,
+             "Consumers in catch-up mode switch back to low-latency batching once lagging by less than this");
+DEFINE_int32(counters_catch_up_batch_rounds, 50, "Number of consume rounds aggregated per write while catching up");
+DEFINE_int32(counters_catch_up_compaction_factor, 4,
+             "Factor applied to L0 compaction and stall triggers while any consumer is catching up");
+
+namespace counters {
+
+std::mutex CountersCatchUpMode::mutex_;
+int CountersCatchUpMode::activeCount_ = 0;
+std::unordered_map<std::string, std::string> CountersCatchUpMode::savedOptions_;
+
+CountersCatchUpMode::CountersCatchUpMode(std::string consumerName, rocksdb::DB* db)
+    : consumerName_(std::move(consumerName)), db_(db), active_(false) {
+  CountersMetrics::set(folly::sformat("catch_up.{}", consumerName_), 0);
+}
+
+CountersCatchUpMode::~CountersCatchUpMode() {
+  if (active_) {
+    CountersMetrics::add("catch_up.active", -1);
+    restoreCompactionTriggers(db_);
+  }
+}
+
+bool CountersCatchUpMode::update(int64_t lagMs) {
+  CountersMetrics::set(folly::sformat("lag_ms.{}", consumerName_), lagMs);
+  if (FLAGS_counters_catch_up_enter_lag_ms <= 0) return false;
+
+  if (!active_ && lagMs > FLAGS_counters_catch_up_enter_lag_ms) {
+    LOG(INFO) << "Consumer `" << consumerName_ << "` is " << lagMs << "ms behind, entering catch-up mode";
+    active_ = true;
+    CountersMetrics::set(folly::sformat("catch_up.{}", consumerName_), 1);
+    CountersMetrics::add("catch_up.active", 1);
+    CountersMetrics::add("catch_up.transitions", 1);
+    relaxCompactionTriggers(db_);
+  } else if (active_ && lagMs < FLAGS_counters_catch_up_exit_lag_ms) {
+    LOG(INFO) << "Consumer `" << consumerName_ << "` is " << lagMs << "ms behind, leaving catch-up mode";
+    active_ = false;
+    CountersMetrics::set(folly::sformat("catch_up.{}", consumerName_), 0);
+    CountersMetrics::add("catch_up.active", -1);
+    CountersMetrics::add("catch_up.transitions", 1);
+    restoreCompactionTriggers(db_);
+  }
+  return active_;
+}
+
+int CountersCatchUpMode::batchRounds() const {
+  return active_ ? FLAGS_counters_catch_up_batch_rounds : 1;
+}
+
+int64_t CountersCatchUpMode::nowMs() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+             std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+
+void CountersCatchUpMode::relaxCompactionTriggers(rocksdb::DB* db) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  if (activeCount_++ > 0 || db == nullptr) return;
+
+  rocksdb::Options options = db->GetOptions();
+  int factor = FLAGS_counters_catch_up_compaction_factor;
+  int compactionTrigger = options.level0_file_num_compaction_trigger;
+  savedOptions_ = {
+      {"level0_file_num_compaction_trigger", folly::to<std::string>(compactionTrigger)},
+      {"level0_slowdown_writes_trigger", folly::to<std::string>(options.level0_slowdown_writes_trigger)},
+      {"level0_stop_writes_trigger", folly::to<std::string>(options.level0_stop_writes_trigger)},
+  };
+  rocksdb::Status status = db->SetOptions({
+      {"level0_file_num_compaction_trigger", folly::to<std::string>(factor * compactionTrigger)},
+      {"level0_slowdown_writes_trigger", folly::to<std::string>(factor * options.level0_slowdown_writes_trigger)},
+      {"level0_stop_writes_trigger", folly::to<std::string>(factor * options.level0_stop_writes_trigger)},
+  });
+  LOG_IF(WARNING, !status.ok()) << "Relaxing compaction triggers failed: " << status.ToString();
+}
+
+void CountersCatchUpMode::restoreCompactionTriggers(rocksdb::DB* db) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  if (--activeCount_ > 0 || db == nullptr) return;
+
+  rocksdb::Status status = db->SetOptions(savedOptions_);
+  LOG_IF(WARNING, !status.ok()) << "Restoring compaction triggers failed: " << status.ToString();
+  savedOptions_.clear();
+}
+
+}  // namespace counters
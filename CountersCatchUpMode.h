@@ -0,0 +1,50 @@
+#ifndef COUNTERS_COUNTERSCATCHUPMODE_H_
+#define COUNTERS_COUNTERSCATCHUPMODE_H_
+
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "rocksdb/db.h"
+
+namespace counters {
+
+// Tracks whether a consumer is far enough behind the head of its log to switch to bulk catch-up processing.
+// While any consumer is catching up, compaction triggers of the database are relaxed so that ingestion is not
+// throttled by the many L0 files a replay produces. They are restored once the last consumer is back near the head.
+class CountersCatchUpMode {
+ public:
+  // db may be null, in which case compaction triggers are left untouched
+  CountersCatchUpMode(std::string consumerName, rocksdb::DB* db);
+  ~CountersCatchUpMode();
+
+  // Update with the lag of the latest processed message and return whether catch-up mode is on.
+  // Entering and leaving use different thresholds so the mode does not flap around a single lag value.
+  bool update(int64_t lagMs);
+
+  bool active() const {
+    return active_;
+  }
+
+  // Number of consume rounds to aggregate into a single write batch while catching up
+  int batchRounds() const;
+
+  static int64_t nowMs();
+
+ private:
+  // Relaxed compaction triggers are reference counted across all consumers sharing the same database
+  static void relaxCompactionTriggers(rocksdb::DB* db);
+  static void restoreCompactionTriggers(rocksdb::DB* db);
+
+  static std::mutex mutex_;
+  static int activeCount_;
+  static std::unordered_map<std::string, std::string> savedOptions_;
+
+  const std::string consumerName_;
+  rocksdb::DB* const db_;
+  bool active_;
+};
+
+}  // namespace counters
+
+#endif  // COUNTERS_COUNTERSCATCHUPMODE_H_
@@ -0,0 +1,73 @@
+#include "counters/CountersCatchUpMode.h"
+#include "counters/CountersHandler.h"
+#include "gflags/gflags.h"
+#include "gtest/gtest.h"
+#include "rocksdb/options.h"
+#include "stesting/TestWithRocksDb.h"
+
+DECLARE_int64(counters_catch_up_enter_lag_ms);
+DECLARE_int64(counters_catch_up_exit_lag_ms);
+DECLARE_int32(counters_catch_up_compaction_factor);
+
+namespace counters {
+
+class CountersCatchUpModeTest : public stesting::TestWithRocksDb {
+ protected:
+  CountersCatchUpModeTest()
+    : stesting::TestWithRocksDb({}, {{"default", CountersHandler::optimizeColumnFamily}}) {
+    FLAGS_counters_catch_up_enter_lag_ms = 1000;
+    FLAGS_counters_catch_up_exit_lag_ms = 100;
+    FLAGS_counters_catch_up_compaction_factor = 4;
+  }
+
+  int slowdownTrigger() {
+    return db()->GetOptions().level0_slowdown_writes_trigger;
+  }
+};
+
+TEST_F(CountersCatchUpModeTest, Hysteresis) {
+  CountersCatchUpMode catchUp("consumer1", nullptr);
+  EXPECT_FALSE(catchUp.update(500));
+  EXPECT_EQ(1, catchUp.batchRounds());
+
+  EXPECT_TRUE(catchUp.update(2000));
+  EXPECT_GT(catchUp.batchRounds(), 1);
+  // stays on between the two thresholds
+  EXPECT_TRUE(catchUp.update(500));
+  EXPECT_TRUE(catchUp.update(100));
+
+  EXPECT_FALSE(catchUp.update(50));
+  // and stays off between them
+  EXPECT_FALSE(catchUp.update(500));
+  EXPECT_EQ(1, catchUp.batchRounds());
+
+  FLAGS_counters_catch_up_enter_lag_ms = 0;
+  EXPECT_FALSE(catchUp.update(2000));
+}
+
+TEST_F(CountersCatchUpModeTest, RelaxesCompactionTriggersOnce) {
+  int trigger = slowdownTrigger();
+  {
+    CountersCatchUpMode catchUp1("consumer1", db());
+    CountersCatchUpMode catchUp2("consumer2", db());
+
+    EXPECT_TRUE(catchUp1.update(2000));
+    EXPECT_EQ(4 * trigger, slowdownTrigger());
+    // a second consumer catching up does not relax them any further
+    EXPECT_TRUE(catchUp2.update(2000));
+    EXPECT_EQ(4 * trigger, slowdownTrigger());
+
+    // triggers stay relaxed until the last consumer is back near the head
+    EXPECT_FALSE(catchUp1.update(0));
+    EXPECT_EQ(4 * trigger, slowdownTrigger());
+    EXPECT_FALSE(catchUp2.update(0));
+    EXPECT_EQ(trigger, slowdownTrigger());
+
+    EXPECT_TRUE(catchUp1.update(2000));
+    EXPECT_EQ(4 * trigger, slowdownTrigger());
+  }
+  // a consumer going away while catching up restores them too
+  EXPECT_EQ(trigger, slowdownTrigger());
+}
+
+}  // namespace counters
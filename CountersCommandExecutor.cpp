@@ -0,0 +1,59 @@
+#include "counters/CountersCommandExecutor.h"
+
+#include <exception>
+#include <utility>
+
+#include "glog/logging.h"
+
+namespace counters {
+
+CountersCommandExecutor::CountersCommandExecutor(size_t numShards) {
+  CHECK_GT(numShards, 0UL);
+  for (size_t i = 0; i < numShards; i++) {
+    shards_.emplace_back(new Shard());
+    Shard* shard = shards_.back().get();
+    shard->thread = std::thread([this, shard]() { runShard(shard); });
+  }
+}
+
+CountersCommandExecutor::~CountersCommandExecutor() {
+  for (auto& shard : shards_) {
+    {
+      std::lock_guard<std::mutex> guard(shard->mutex);
+      shard->stopped = true;
+    }
+    shard->cv.notify_one();
+  }
+  for (auto& shard : shards_) {
+    shard->thread.join();
+  }
+}
+
+folly::Future<codec::RedisValue> CountersCommandExecutor::submit(const std::string& shardKey,
+                                                                 std::function<codec::RedisValue()> func) {
+  Shard* shard = shards_[std::hash<std::string>()(shardKey) % shards_.size()].get();
+  auto promise = std::make_shared<folly::Promise<codec::RedisValue>>();
+  folly::Future<codec::RedisValue> future = promise->getFuture();
+  {
+    std::lock_guard<std::mutex> guard(shard->mutex);
+    shard->queue.emplace_back([promise, func]() { promise->setWith(func); });
+  }
+  shard->cv.notify_one();
+  return future;
+}
+
+void CountersCommandExecutor::runShard(Shard* shard) {
+  while (true) {
+    std::function<void()> task;
+    {
+      std::unique_lock<std::mutex> lock(shard->mutex);
+      shard->cv.wait(lock, [shard]() { return shard->stopped || !shard->queue.empty(); });
+      if (shard->queue.empty()) return;  // stopped and fully drained
+      task = std::move(shard->queue.front());
+      shard->queue.pop_front();
+    }
+    task();
+  }
+}
+
+}  // namespace counters
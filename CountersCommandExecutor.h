@@ -0,0 +1,50 @@
+#ifndef COUNTERS_COUNTERSCOMMANDEXECUTOR_H_
+#define COUNTERS_COUNTERSCOMMANDEXECUTOR_H_
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "codec/RedisValue.h"
+#include "folly/futures/Future.h"
+
+namespace counters {
+
+// A pool of single-threaded executors sharded by key hash. Commands on the same key always run on the same shard
+// in submission order, while slow reads on one shard do not hold up commands on the others.
+class CountersCommandExecutor {
+ public:
+  explicit CountersCommandExecutor(size_t numShards);
+
+  // Stop all shards after draining their queues
+  ~CountersCommandExecutor();
+
+  // Run func on the shard owning shardKey and fulfill the returned future with its result
+  folly::Future<codec::RedisValue> submit(const std::string& shardKey, std::function<codec::RedisValue()> func);
+
+  size_t numShards() const {
+    return shards_.size();
+  }
+
+ private:
+  struct Shard {
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<std::function<void()>> queue;
+    bool stopped = false;
+    std::thread thread;
+  };
+
+  void runShard(Shard* shard);
+
+  std::vector<std::unique_ptr<Shard>> shards_;
+};
+
+}  // namespace counters
+
+#endif  // COUNTERS_COUNTERSCOMMANDEXECUTOR_H_
@@ -0,0 +1,30 @@
+#include <vector>
+
+#include "codec/RedisValue.h"
+#include "counters/CountersCommandExecutor.h"
+#include "folly/futures/Future.h"
+#include "gtest/gtest.h"
+
+namespace counters {
+
+TEST(CountersCommandExecutorTest, PreservesOrderPerKey) {
+  CountersCommandExecutor executor(4);
+  std::vector<int64_t> seen;
+  std::vector<folly::Future<codec::RedisValue>> results;
+  for (int64_t i = 0; i < 100; i++) {
+    // tasks on the same key run on the same shard, one at a time
+    results.push_back(executor.submit("key1", [&seen, i]() {
+      seen.push_back(i);
+      return codec::RedisValue(i);
+    }));
+  }
+  for (int64_t i = 0; i < 100; i++) {
+    EXPECT_EQ(codec::RedisValue(i), results[i].get());
+  }
+  ASSERT_EQ(100UL, seen.size());
+  for (int64_t i = 0; i < 100; i++) {
+    EXPECT_EQ(i, seen[i]);
+  }
+}
+
+}  // namespace counters
@@ -6,8 +6,9 @@
 #include <unordered_map>
 #include <utility>
 
-#include "boost/endian/buffers.hpp"
 #include "counters/CounterRecord.hh"
+#include "counters/CountersMemory.h"
+#include "counters/CountersValue.h"
 #include "folly/Format.h"
 #include "glog/logging.h"
 #include "infra/AvroHelper.h"
@@ -17,35 +18,43 @@ namespace counters {
 using infra::kafka::store::KafkaStoreMessage;
 
 void CountersDecrementKafkaStoreConsumer::processBatch(int timeoutMs) {
+  // let compaction catch up before adding more to its debt
+  backpressure_.throttle([this]() { return run(); });
   ProcessingBuf buf = {};
   int64_t count = consumeBatch(timeoutMs, &buf);
-  LOG(INFO) << "Read " << count << " messages in `" << mode_ << "` mode";
-  commitCounts(buf);
-
-  // processed delayed messages
-  std::map<int64_t, infra::kafka::store::KafkaStoreMessage> delayedMsgs = std::move(buf.msgBuf);
-  while (run() && !delayedMsgs.empty()) {
-    // delay until the first message is due
-    if (!delay(timeDelayMs_, delayedMsgs.begin()->second.timestamp)) {
-      // Break early due to failed delay, e.g., the program is being terminated
-      break;
-    }
-    ProcessingBuf delayedBuf = {};
-    for (const auto& entry : delayedMsgs) {
-      processOne(entry.first, entry.second, &delayedBuf);
+  if (catchUp_.update(buf.lagMs)) {
+    // Every message read so far is long overdue, so aggregate more batches into a single write and offset checkpoint
+    // until messages that still need a delay show up
+    for (int round = 1; round < catchUp_.batchRounds() && run() && buf.msgBuf.empty(); round++) {
+      backpressure_.throttle([this]() { return run(); });
+      int64_t roundCount = consumeBatch(timeoutMs, &buf);
+      count += roundCount;
+      if (roundCount == 0 || !catchUp_.update(buf.lagMs)) break;
     }
-    commitCounts(delayedBuf);
-    delayedMsgs = std::move(delayedBuf.msgBuf);
   }
+  LOG(INFO) << "Read " << count << " messages in `" << mode_ << "` mode";
+  processDelayed(&buf, false);
+  buffer_.update(0);
 }
 
 void CountersDecrementKafkaStoreConsumer::processOne(int64_t offset, const infra::kafka::store::KafkaStoreMessage& msg,
                                                      void* opaque) {
   auto buf = static_cast<ProcessingBuf*>(opaque);
+  applyOrBuffer(offset, msg, buf);
+  if (buffer_.update(buf->bytes)) {
+    // This consumer holds its part of an exceeded memory budget, so write out the counts applied so far and hold off
+    // reading more until enough of the buffered messages came due
+    processDelayed(buf, true);
+  }
+}
+
+void CountersDecrementKafkaStoreConsumer::applyOrBuffer(int64_t offset, const KafkaStoreMessage& msg,
+                                                        ProcessingBuf* buf) {
   if (!buf->msgBuf.empty()) {
     // Assume that timestamps from kafka store messages are monotonically increasing
     // so once one message was buffered for delayed processing, all subsequent messages should follow
     buf->msgBuf.insert(std::make_pair(offset, msg));
+    buf->bytes += kBufferedMessageBytes;
     return;
   }
   if (msg.value.is_null()) {
@@ -57,21 +66,54 @@ void CountersDecrementKafkaStoreConsumer::processOne(int64_t offset, const infra
   auto valBytes = msg.value.get_bytes();
   Counter record;
   infra::AvroHelper::decode(valBytes.data(), valBytes.size(), &record);
-  if (nowMs() - msg.timestamp >= timeDelayMs_) {
+  int64_t overdueMs = nowMs() - msg.timestamp - timeDelayMs_;
+  if (overdueMs >= 0) {
     // this message is overdue, apply the count
     std::string key(reinterpret_cast<const char*>(record.key.data()), record.key.size());
-    int64_t timespanFlags = record.flags ? record.flags : CountersTimespans::kDefaultTimespanFlags;
-    if (timespanFlags & timespanMask_) {
+    if (CountersTimespans::instance().resolveFlags(key, record.flags) & timespanMask_) {
       key.append(keySuffix_);
-      buf->counts[key] -= record.by;
+      auto result = buf->counts.emplace(key, 0);
+      result.first->second -= record.by;
+      if (result.second) buf->bytes += key.size() + kCountEntryOverheadBytes;
     }
     buf->nextProcessOffset = offset + 1;
+    buf->lagMs = overdueMs;
   } else {
     // save the messaged for delayed processing
     buf->msgBuf.insert(std::make_pair(offset, msg));
+    buf->bytes += kBufferedMessageBytes;
   }
 }
 
+void CountersDecrementKafkaStoreConsumer::processDelayed(ProcessingBuf* buf, bool untilWithinBudget) {
+  commitCounts(*buf);
+
+  std::map<int64_t, KafkaStoreMessage> delayedMsgs = std::move(buf->msgBuf);
+  int64_t bytes = delayedMsgs.size() * kBufferedMessageBytes;
+  while (run() && !delayedMsgs.empty()) {
+    if (untilWithinBudget && !buffer_.update(bytes)) break;
+    // delay until the first message is due
+    if (!delay(timeDelayMs_, delayedMsgs.begin()->second.timestamp)) {
+      // Break early due to failed delay, e.g., the program is being terminated
+      break;
+    }
+    ProcessingBuf delayedBuf = {};
+    for (const auto& entry : delayedMsgs) {
+      applyOrBuffer(entry.first, entry.second, &delayedBuf);
+    }
+    commitCounts(delayedBuf);
+    delayedMsgs = std::move(delayedBuf.msgBuf);
+    bytes = delayedMsgs.size() * kBufferedMessageBytes;
+  }
+
+  // messages still delayed stay buffered, ahead of any read later in the batch
+  buf->counts.clear();
+  buf->msgBuf = std::move(delayedMsgs);
+  buf->nextProcessOffset = -1;
+  buf->bytes = bytes;
+  buffer_.update(bytes);
+}
+
 void CountersDecrementKafkaStoreConsumer::commitCounts(const CountersDecrementKafkaStoreConsumer::ProcessingBuf& buf) {
   if (buf.counts.empty() && buf.msgBuf.empty()) {
     // The entire batch is empty
@@ -81,10 +123,10 @@ void CountersDecrementKafkaStoreConsumer::commitCounts(const CountersDecrementKa
   int64_t nextOffset = buf.nextProcessOffset >= 0 ? buf.nextProcessOffset : buf.msgBuf.begin()->first;
   rocksdb::WriteBatch writeBatch;
   for (const auto& entry : buf.counts) {
-    boost::endian::big_int64_buf_t value(entry.second);
-    writeBatch.Merge(entry.first, rocksdb::Slice(value.data(), sizeof(int64_t)));
+    writeBatch.Merge(entry.first, CountersValue::encode(entry.second));
   }
   int64_t fileOffset = buf.nextProcessOffset < nextFileOffset() ? currentFileOffset() : nextFileOffset();
+  CountersGroupCommit::instance()->gather(true);
   CHECK(consumerHelper()->commitNextProcessKafkaAndFileOffsets(offsetKey(), nextOffset, fileOffset, &writeBatch));
   // Also commit to kafka brokers only for metrics and reporting, so failure is okay
   if (!commitAsync()) {
@@ -99,6 +141,8 @@ bool CountersDecrementKafkaStoreConsumer::delay(int64_t delayMs, int64_t timeMs)
 
   if (sleepTimeMs <= 0) return true;
   DLOG(INFO) << "Sleeping for " << sleepTimeMs << "ms for delay in `" << mode_ << "` mode";
+  // other consumers committing meanwhile should not wait for this one
+  CountersGroupCommit::Idle idle(&groupCommitParticipant_);
   while (sleepTimeMs > 0) {
     if (!run()) return false;
     std::this_thread::sleep_for(std::min(std::chrono::milliseconds(1000), std::chrono::milliseconds(sleepTimeMs)));
@@ -9,9 +9,14 @@
 #include <vector>
 
 #include "boost/algorithm/string/predicate.hpp"
+#include "counters/CountersBackpressure.h"
+#include "counters/CountersCatchUpMode.h"
+#include "counters/CountersGroupCommit.h"
+#include "counters/CountersMemory.h"
 #include "counters/CountersTimespans.h"
 #include "infra/kafka/store/Consumer.h"
 #include "infra/kafka/store/KafkaStoreMessageRecord.hh"
+#include "rocksdb/db.h"
 
 namespace counters {
 
@@ -26,15 +31,18 @@ class CountersDecrementKafkaStoreConsumer : public infra::kafka::store::Consumer
                                       int partition, const std::string& groupId, const std::string& offsetKey,
                                       const std::string& mode,
                                       std::shared_ptr<infra::kafka::ConsumerHelper> consumerHelper,
-                                      std::shared_ptr<platform::gcloud::GoogleCloudStorage> gcs)
+                                      std::shared_ptr<platform::gcloud::GoogleCloudStorage> gcs, rocksdb::DB* db)
       : infra::kafka::store::Consumer(brokerList, objectStoreBucketName, objectStoreObjectNamePrefix, topic, partition,
                                       groupId, offsetKey, consumerHelper, gcs),
-        mode_(mode) {
-    const auto it = CountersTimespans::kTimespanMap.find(mode);
-    CHECK(it != CountersTimespans::kTimespanMap.end()) << "Unknown mode: " << mode;
-    timeDelayMs_ = it->second.timeDelayMs;
-    keySuffix_ = it->second.keySuffix;
-    timespanMask_ = it->second.mask;
+        mode_(mode),
+        buffer_(offsetKey),
+        catchUp_(offsetKey, db),
+        backpressure_(offsetKey, db, &groupCommitParticipant_) {
+    const CountersTimespans::Timespan* timespan = CountersTimespans::instance().find(mode);
+    CHECK(timespan != nullptr) << "Unknown mode: " << mode;
+    timeDelayMs_ = timespan->timeDelayMs;
+    keySuffix_ = timespan->keySuffix;
+    timespanMask_ = timespan->mask;
   }
 
   // Process a batch of messages and wait for the right time to decrement
@@ -50,11 +58,26 @@ class CountersDecrementKafkaStoreConsumer : public infra::kafka::store::Consumer
     // buffer for messages to be processed after a delay, keyed by kafka offset
     std::map<int64_t, infra::kafka::store::KafkaStoreMessage> msgBuf;
     int64_t nextProcessOffset = -1;
+    // how long the last applied message had been overdue
+    int64_t lagMs = 0;
+    // approximate memory taken by counts and msgBuf
+    int64_t bytes = 0;
   };
 
   // Allow a margin of error in time delay in order to group more keys in a single transaction
   static constexpr int64_t kDelayMarginMs = 1000;
 
+  // Approximate memory taken by one aggregated count besides its key, and by one buffered counter message
+  static constexpr int64_t kCountEntryOverheadBytes = 64;
+  static constexpr int64_t kBufferedMessageBytes = 256;
+
+  // Apply the count of a message if it is overdue, or buffer it for delayed processing
+  void applyOrBuffer(int64_t offset, const infra::kafka::store::KafkaStoreMessage& msg, ProcessingBuf* buf);
+
+  // Commit the counts in buf, then apply buffered messages as they come due. With untilWithinBudget, stop once
+  // this consumer's buffer fits its part of the memory budget again and keep the remaining messages buffered in buf.
+  void processDelayed(ProcessingBuf* buf, bool untilWithinBudget);
+
   // Commit counts that are overdue
   void commitCounts(const ProcessingBuf& buf);
 
@@ -65,6 +88,10 @@ class CountersDecrementKafkaStoreConsumer : public infra::kafka::store::Consumer
   int64_t timeDelayMs_;
   std::string keySuffix_;
   int64_t timespanMask_;
+  CountersMemory::ConsumerBuffer buffer_;
+  CountersCatchUpMode catchUp_;
+  CountersBackpressure backpressure_;
+  CountersGroupCommit::Participant groupCommitParticipant_;
 };
 
 }  // namespace counters
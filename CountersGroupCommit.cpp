@@ -0,0 +1,87 @@
+#include "counters/CountersGroupCommit.h"
+
+#include "counters/CountersMetrics.h"
+#include "gflags/gflags.h"
+
+DEFINE_int64(counters_group_commit_max_wait_us, 0,
+             "How long consumers wait for the others that are not sleeping, so that their writes share a RocksDB "
+             "write group; 0 disables it. Async handler writes join a group already gathering, while inline and "
+             "MULTI/EXEC commands never wait");
+
+namespace counters {
+
+CountersGroupCommit::Participant::Participant(CountersGroupCommit* groupCommit) : groupCommit_(groupCommit) {
+  groupCommit_->addParticipant();
+}
+
+CountersGroupCommit::Participant::~Participant() {
+  groupCommit_->removeParticipant();
+}
+
+CountersGroupCommit::Idle::Idle(Participant* participant) : participant_(participant) {
+  if (participant_) participant_->groupCommit_->removeParticipant();
+}
+
+CountersGroupCommit::Idle::~Idle() {
+  if (participant_) participant_->groupCommit_->addParticipant();
+}
+
+CountersGroupCommit* CountersGroupCommit::instance() {
+  static CountersGroupCommit groupCommit;
+  return &groupCommit;
+}
+
+bool CountersGroupCommit::enabled() {
+  return FLAGS_counters_group_commit_max_wait_us > 0;
+}
+
+void CountersGroupCommit::gather(bool lead) {
+  if (!enabled()) return;
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (waiting_ == 0) {
+    // nobody else could join a group
+    if (!lead || participants_ < 2) return;
+    deadline_ = std::chrono::steady_clock::now() + std::chrono::microseconds(FLAGS_counters_group_commit_max_wait_us);
+  }
+  uint64_t epoch = epoch_;
+  if (lead) {
+    waiting_++;
+    if (waiting_ >= participants_) {
+      release();
+      return;
+    }
+  } else {
+    joiners_++;
+  }
+  if (!cv_.wait_until(lock, deadline_, [this, epoch]() { return epoch_ != epoch; })) {
+    // the latency budget ran out before everyone arrived
+    release();
+  }
+}
+
+void CountersGroupCommit::addParticipant() {
+  std::lock_guard<std::mutex> guard(mutex_);
+  participants_++;
+}
+
+void CountersGroupCommit::removeParticipant() {
+  std::lock_guard<std::mutex> guard(mutex_);
+  participants_--;
+  // the group may be waiting for this participant
+  if (waiting_ > 0 && waiting_ >= participants_) {
+    release();
+  }
+}
+
+void CountersGroupCommit::release() {
+  CountersMetrics::add("group_commit.groups", 1);
+  CountersMetrics::add("group_commit.writers", waiting_ + joiners_);
+  CountersMetrics::add("group_commit.joiners", joiners_);
+  epoch_++;
+  waiting_ = 0;
+  joiners_ = 0;
+  cv_.notify_all();
+}
+
+}  // namespace counters
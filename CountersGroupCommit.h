@@ -0,0 +1,77 @@
+#ifndef COUNTERS_COUNTERSGROUPCOMMIT_H_
+#define COUNTERS_COUNTERSGROUPCOMMIT_H_
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+
+namespace counters {
+
+// Lines up writes from concurrent consumers and async handler commands, so that they reach RocksDB together and get
+// merged into a single write group, sharing one WAL write and sync. Every participant still writes its own
+// WriteBatch, including its offsets, so atomicity and per-consumer offset ordering are unchanged. The coordinator only
+// holds writers back until all active participants arrived or the latency budget ran out.
+// Commands run inline on the IO threads, including MULTI/EXEC, are committed by the transactional handler and are not
+// coordinated, since holding them back would stall every connection on that thread.
+class CountersGroupCommit {
+ public:
+  class Idle;
+
+  // Registers a long-lived writer, such as a consumer, that the coordinator waits for while gathering a group
+  class Participant {
+   public:
+    explicit Participant(CountersGroupCommit* groupCommit = instance());
+    ~Participant();
+
+   private:
+    friend class Idle;
+
+    CountersGroupCommit* groupCommit_;
+  };
+
+  // Takes a participant out of the groups for as long as it sleeps, such as a consumer delaying records or backing
+  // off under compaction pressure, so that the others do not wait for it until their deadline. The participant may be
+  // null for writers that do not take part in group commits.
+  class Idle {
+   public:
+    explicit Idle(Participant* participant);
+    ~Idle();
+
+   private:
+    Participant* participant_;
+  };
+
+  CountersGroupCommit() {}
+
+  static CountersGroupCommit* instance();
+
+  static bool enabled();
+
+  // Block until the current group is complete and return right before the caller writes.
+  // With lead set, the caller is a participant and a new group is started when none is gathering. Otherwise the
+  // caller only joins a group that is already gathering: it waits for that group's release, at most until its
+  // deadline, but is not counted towards the participants the group waits for.
+  void gather(bool lead);
+
+ private:
+  void addParticipant();
+  // Also releases the current group when it was only waiting for the removed participant
+  void removeParticipant();
+
+  // Release everyone waiting in the current group; must hold mutex_
+  void release();
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  // registered participants that are not idle
+  size_t participants_ = 0;
+  // participants waiting in the group currently gathering, and other writers that joined it
+  size_t waiting_ = 0;
+  size_t joiners_ = 0;
+  uint64_t epoch_ = 0;
+  std::chrono::steady_clock::time_point deadline_;
+};
+
+}  // namespace counters
+
+#endif  // COUNTERS_COUNTERSGROUPCOMMIT_H_
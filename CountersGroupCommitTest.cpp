@@ -0,0 +1,185 @@
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+
+#include "counters/CountersGroupCommit.h"
+#include "counters/CountersMetrics.h"
+#include "gflags/gflags.h"
+#include "gtest/gtest.h"
+
+DECLARE_int64(counters_group_commit_max_wait_us);
+
+namespace counters {
+
+class CountersGroupCommitTest : public ::testing::Test {
+ protected:
+  CountersGroupCommitTest()
+      : groups_(CountersMetrics::get("group_commit.groups")),
+        writers_(CountersMetrics::get("group_commit.writers")),
+        joiners_(CountersMetrics::get("group_commit.joiners")) {}
+
+  ~CountersGroupCommitTest() {
+    FLAGS_counters_group_commit_max_wait_us = 0;
+  }
+
+  int64_t groups() {
+    return CountersMetrics::get("group_commit.groups") - groups_;
+  }
+  int64_t writers() {
+    return CountersMetrics::get("group_commit.writers") - writers_;
+  }
+  int64_t joiners() {
+    return CountersMetrics::get("group_commit.joiners") - joiners_;
+  }
+
+  // Let a thread that was just started block in gather
+  static void settle() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  }
+
+  CountersGroupCommit groupCommit_;
+
+ private:
+  int64_t groups_;
+  int64_t writers_;
+  int64_t joiners_;
+};
+
+TEST_F(CountersGroupCommitTest, Disabled) {
+  FLAGS_counters_group_commit_max_wait_us = 0;
+  CountersGroupCommit::Participant participant1(&groupCommit_);
+  CountersGroupCommit::Participant participant2(&groupCommit_);
+
+  groupCommit_.gather(true);
+  EXPECT_EQ(0, groups());
+}
+
+TEST_F(CountersGroupCommitTest, ReleasesWhenAllParticipantsArrive) {
+  FLAGS_counters_group_commit_max_wait_us = 10 * 1000 * 1000;
+  CountersGroupCommit::Participant participant1(&groupCommit_);
+  CountersGroupCommit::Participant participant2(&groupCommit_);
+
+  auto start = std::chrono::steady_clock::now();
+  std::thread leader([this]() { groupCommit_.gather(true); });
+  settle();
+  groupCommit_.gather(true);
+  leader.join();
+
+  EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(5));
+  EXPECT_EQ(1, groups());
+  EXPECT_EQ(2, writers());
+}
+
+TEST_F(CountersGroupCommitTest, ReleasesOnTimeout) {
+  FLAGS_counters_group_commit_max_wait_us = 20 * 1000;
+  CountersGroupCommit::Participant participant1(&groupCommit_);
+  CountersGroupCommit::Participant participant2(&groupCommit_);
+
+  auto start = std::chrono::steady_clock::now();
+  groupCommit_.gather(true);
+
+  EXPECT_GE(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(20));
+  EXPECT_EQ(1, groups());
+  EXPECT_EQ(1, writers());
+}
+
+TEST_F(CountersGroupCommitTest, ParticipantDestructorReleasesWaiters) {
+  FLAGS_counters_group_commit_max_wait_us = 10 * 1000 * 1000;
+  CountersGroupCommit::Participant participant1(&groupCommit_);
+  std::unique_ptr<CountersGroupCommit::Participant> participant2(new CountersGroupCommit::Participant(&groupCommit_));
+
+  auto start = std::chrono::steady_clock::now();
+  std::thread leader([this]() { groupCommit_.gather(true); });
+  settle();
+  // the group no longer waits for a participant that went away
+  participant2.reset();
+  leader.join();
+
+  EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(5));
+  EXPECT_EQ(1, groups());
+  EXPECT_EQ(1, writers());
+}
+
+TEST_F(CountersGroupCommitTest, IdleParticipantsAreNotWaitedFor) {
+  FLAGS_counters_group_commit_max_wait_us = 10 * 1000 * 1000;
+  CountersGroupCommit::Participant participant1(&groupCommit_);
+  CountersGroupCommit::Participant participant2(&groupCommit_);
+  CountersGroupCommit::Participant participant3(&groupCommit_);
+
+  auto start = std::chrono::steady_clock::now();
+  {
+    // with one of the others sleeping, a group is gathered for the remaining two only
+    CountersGroupCommit::Idle idle(&participant3);
+    std::thread leader([this]() { groupCommit_.gather(true); });
+    settle();
+    groupCommit_.gather(true);
+    leader.join();
+  }
+  EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(5));
+  EXPECT_EQ(1, groups());
+  EXPECT_EQ(2, writers());
+
+  {
+    // and with everyone else sleeping, there is no group to gather at all
+    CountersGroupCommit::Idle idle2(&participant2);
+    CountersGroupCommit::Idle idle3(&participant3);
+    groupCommit_.gather(true);
+  }
+  EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(5));
+  EXPECT_EQ(1, groups());
+}
+
+TEST_F(CountersGroupCommitTest, GoingIdleReleasesWaiters) {
+  FLAGS_counters_group_commit_max_wait_us = 10 * 1000 * 1000;
+  CountersGroupCommit::Participant participant1(&groupCommit_);
+  CountersGroupCommit::Participant participant2(&groupCommit_);
+
+  auto start = std::chrono::steady_clock::now();
+  std::thread leader([this]() { groupCommit_.gather(true); });
+  settle();
+  {
+    // the group no longer waits for a participant that started sleeping
+    CountersGroupCommit::Idle idle(&participant2);
+    leader.join();
+  }
+
+  EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(5));
+  EXPECT_EQ(1, groups());
+  EXPECT_EQ(1, writers());
+}
+
+TEST_F(CountersGroupCommitTest, JoinersDoNotCountAsParticipants) {
+  FLAGS_counters_group_commit_max_wait_us = 10 * 1000 * 1000;
+  CountersGroupCommit::Participant participant1(&groupCommit_);
+  CountersGroupCommit::Participant participant2(&groupCommit_);
+
+  // without a group gathering, other writers never wait
+  groupCommit_.gather(false);
+  EXPECT_EQ(0, groups());
+
+  std::atomic<bool> leaderDone(false);
+  std::atomic<bool> joinerDone(false);
+  std::thread leader([this, &leaderDone]() {
+    groupCommit_.gather(true);
+    leaderDone = true;
+  });
+  settle();
+  std::thread joiner([this, &joinerDone]() {
+    groupCommit_.gather(false);
+    joinerDone = true;
+  });
+  settle();
+  // the joiner does not complete the group in place of the second participant
+  EXPECT_FALSE(leaderDone);
+  EXPECT_FALSE(joinerDone);
+
+  groupCommit_.gather(true);
+  leader.join();
+  joiner.join();
+  EXPECT_EQ(1, groups());
+  EXPECT_EQ(3, writers());
+  EXPECT_EQ(1, joiners());
+}
+
+}  // namespace counters
@@ -1,19 +1,135 @@
 #include "counters/CountersHandler.h"
 
+#include <algorithm>
+#include <memory>
 #include <stdexcept>
 #include <string>
+#include <utility>
 #include <vector>
 
-#include "boost/endian/buffers.hpp"
+#include "boost/algorithm/string/predicate.hpp"
 #include "folly/Conv.h"
+#include "folly/Format.h"
+#include "folly/String.h"
+#include "folly/io/async/EventBase.h"
 #include "glog/logging.h"
+#include "codec/RedisMessage.h"
 #include "codec/RedisValue.h"
+#include "counters/CountersGroupCommit.h"
+#include "counters/CountersHotKeys.h"
+#include "counters/CountersMemory.h"
+#include "counters/CountersMetrics.h"
+#include "counters/CountersSlowLog.h"
+#include "counters/CountersTimespans.h"
+#include "counters/CountersValue.h"
+#include "rocksdb/iterator.h"
 #include "rocksdb/options.h"
 #include "rocksdb/slice.h"
+#include "rocksdb/statistics.h"
 #include "rocksdb/status.h"
 
 namespace counters {
 
+void CountersHandler::detachPipeline(Context* ctx) {
+  closed_ = true;
+  TransactionalRedisHandler::detachPipeline(ctx);
+}
+
+bool CountersHandler::handleCommand(int64_t key, const std::string& cmdNameLower, const std::vector<std::string>& cmd,
+                                    Context* ctx) {
+  if (!executor_) {
+    return runCommand(key, cmdNameLower, cmd, ctx);
+  }
+
+  // Commands inside MULTI are queued into a single write batch by the transactional handler, so keep them inline
+  if (!inTransaction_) {
+    const auto& table = getCountersCommandTable();
+    auto it = table.find(cmdNameLower);
+    int numArgs = static_cast<int>(cmd.size()) - 1;
+    if (it != table.end() && it->second.keyed && numArgs >= it->second.minArgs && numArgs <= it->second.maxArgs) {
+      dispatchAsync(it->second, cmd, ctx);
+      return true;
+    }
+  }
+
+  if (cmdNameLower == "multi") {
+    inTransaction_ = true;
+  } else if (cmdNameLower == "exec" || cmdNameLower == "discard") {
+    inTransaction_ = false;
+  }
+  return handleInOrder(key, cmdNameLower, cmd, ctx);
+}
+
+folly::EventBase* CountersHandler::getEventBase(Context* ctx) {
+  return ctx->getTransport()->getEventBase();
+}
+
+bool CountersHandler::runCommand(int64_t key, const std::string& cmdNameLower, const std::vector<std::string>& cmd,
+                                 Context* ctx) {
+  CountersSlowLog::Sample sample(cmd);
+  return TransactionalRedisHandler::handleCommand(key, cmdNameLower, cmd, ctx);
+}
+
+void CountersHandler::dispatchAsync(const CountersCommandInfo& info, const std::vector<std::string>& cmd,
+                                    Context* ctx) {
+  // the task holds on to the handler, and with it the database manager, so releasing the connection never waits for it
+  CountersCommandFunc func = info.func;
+  folly::Future<codec::RedisValue> result =
+      executor_->submit(cmd[1], [self = shared_from_this(), func, cmd, ctx]() -> codec::RedisValue {
+        CountersSlowLog::Sample sample(cmd);
+        rocksdb::WriteBatch writeBatch;
+        codec::RedisValue resp = (self.get()->*func)(cmd, &writeBatch, ctx);
+        if (writeBatch.Count() > 0) {
+          // join a group the consumers are gathering, waiting at most until its deadline, but never start one
+          CountersGroupCommit::instance()->gather(false);
+          rocksdb::Status status = self->db()->Write(rocksdb::WriteOptions(), &writeBatch);
+          if (!status.ok()) {
+            return self->errorResp(folly::sformat("RocksDB error: {}", status.ToString()));
+          }
+        }
+        return resp;
+      });
+
+  pendingReplies_++;
+  std::weak_ptr<CountersHandler> weak = shared_from_this();
+  replyChain_ = std::move(replyChain_)
+                    .then([result = std::move(result)]() mutable { return std::move(result); })
+                    .via(getEventBase(ctx))
+                    .then([weak, ctx](folly::Try<codec::RedisValue>&& resp) {
+                      std::shared_ptr<CountersHandler> self = weak.lock();
+                      if (!self || self->closed_) return;
+                      self->pendingReplies_--;
+                      if (resp.hasException()) {
+                        self->write(ctx, codec::RedisMessage(self->errorResp(resp.exception().what().toStdString())));
+                      } else {
+                        self->write(ctx, codec::RedisMessage(std::move(resp.value())));
+                      }
+                    });
+}
+
+bool CountersHandler::handleInOrder(int64_t key, const std::string& cmdNameLower, const std::vector<std::string>& cmd,
+                                    Context* ctx) {
+  if (pendingReplies_ == 0) {
+    return runCommand(key, cmdNameLower, cmd, ctx);
+  }
+
+  // Earlier commands are still running on the executor, so run this one after their replies have been written
+  pendingReplies_++;
+  std::weak_ptr<CountersHandler> weak = shared_from_this();
+  replyChain_ = std::move(replyChain_)
+                    .via(getEventBase(ctx))
+                    .then([weak, key, cmdNameLower, cmd, ctx]() {
+                      std::shared_ptr<CountersHandler> self = weak.lock();
+                      if (!self || self->closed_) return;
+                      self->pendingReplies_--;
+                      if (!self->runCommand(key, cmdNameLower, cmd, ctx)) {
+                        self->write(ctx, codec::RedisMessage(self->errorResp(
+                                             folly::sformat("unknown command '{}'", cmdNameLower))));
+                      }
+                    });
+  return true;
+}
+
 codec::RedisValue CountersHandler::ensureCommand(const std::vector<std::string>& cmd, rocksdb::WriteBatch* writeBatch,
                                                  Context* ctx) {
   rocksdb::Slice key = rocksdb::Slice(cmd[1]);
@@ -29,8 +145,9 @@ codec::RedisValue CountersHandler::ensureCommand(const std::vector<std::string>&
   rocksdb::Status status = db()->Get(rocksdb::ReadOptions(), key, &value);
 
   if (status.ok()) {
-    CHECK_EQ(value.size(), sizeof(int64_t));
-    if (desiredValue == boost::endian::detail::load_big_endian<int64_t, sizeof(int64_t)>(value.data())) {
+    int64_t intValue = 0;
+    CHECK(CountersValue::decode(value, &intValue));
+    if (desiredValue == intValue) {
       return simpleStringOk();
     }
     return { codec::RedisValue::Type::kError, "ENSURE value different" };
@@ -44,14 +161,16 @@ codec::RedisValue CountersHandler::ensureCommand(const std::vector<std::string>&
 codec::RedisValue CountersHandler::getCommand(const std::vector<std::string>& cmd, rocksdb::WriteBatch* writeBatch,
                                               Context* ctx) {
   rocksdb::Slice key = rocksdb::Slice(cmd[1]);
+  CountersHotKeys::instance()->recordRead(cmd[1]);
 
   std::string value;
   // TODO(yunjing): support read-your-own-write by search the write batch first, when such guaranteed is needed
   rocksdb::Status status = db()->Get(rocksdb::ReadOptions(), key, &value);
 
   if (status.ok()) {
-    CHECK_EQ(value.size(), sizeof(int64_t));
-    return codec::RedisValue(boost::endian::detail::load_big_endian<int64_t, sizeof(int64_t)>(value.data()));
+    int64_t intValue = 0;
+    CHECK(CountersValue::decode(value, &intValue));
+    return codec::RedisValue(intValue);
   } else if (status.IsNotFound()) {
     return codec::RedisValue::nullString();
   }
@@ -68,10 +187,10 @@ codec::RedisValue CountersHandler::incrbyCommand(const std::vector<std::string>&
   } catch (std::range_error&) {
     return errorInvalidInteger();
   }
+  CountersHotKeys::instance()->recordRead(cmd[1]);
 
-  boost::endian::big_int64_buf_t value(delta);
   // using merge to ensure atomicity with respect to multiple concurrent incrby operations
-  writeBatch->Merge(key, rocksdb::Slice(value.data(), sizeof(int64_t)));
+  writeBatch->Merge(key, CountersValue::encode(delta));
   std::string prevValue;
   // reading existing from database is still subject to race condition when there is a concurrent write,
   // but the returned value is guaranteed to be one of many legit values under certain interleaving of writes
@@ -79,8 +198,8 @@ codec::RedisValue CountersHandler::incrbyCommand(const std::vector<std::string>&
   rocksdb::Status status = db()->Get(rocksdb::ReadOptions(), key, &prevValue);
 
   if (status.ok()) {
-    CHECK_EQ(prevValue.size(), sizeof(int64_t));
-    int64_t prevInt = boost::endian::detail::load_big_endian<int64_t, sizeof(int64_t)>(prevValue.data());
+    int64_t prevInt = 0;
+    CHECK(CountersValue::decode(prevValue, &prevInt));
     return codec::RedisValue(prevInt + delta);
   } else if (status.IsNotFound()) {
     return codec::RedisValue(delta);
@@ -89,12 +208,210 @@ codec::RedisValue CountersHandler::incrbyCommand(const std::vector<std::string>&
   return errorResp(folly::sformat("RocksDB error: {}", status.ToString()));
 }
 
+codec::RedisValue CountersHandler::memoryCommand(const std::vector<std::string>& cmd, rocksdb::WriteBatch* writeBatch,
+                                                 Context* ctx) {
+  std::vector<codec::RedisValue> result;
+  for (auto& entry : CountersMemory::report(db())) {
+    result.emplace_back(std::move(entry.first));
+    result.emplace_back(entry.second);
+  }
+  // RocksDB's own view of write grouping, to compare against group_commit.writers / group_commit.groups
+  std::shared_ptr<rocksdb::Statistics> statistics = db()->GetDBOptions().statistics;
+  if (statistics) {
+    result.emplace_back(std::string("rocksdb.write_done_by_self"));
+    result.emplace_back(static_cast<int64_t>(statistics->getTickerCount(rocksdb::WRITE_DONE_BY_SELF)));
+    result.emplace_back(std::string("rocksdb.write_done_by_other"));
+    result.emplace_back(static_cast<int64_t>(statistics->getTickerCount(rocksdb::WRITE_DONE_BY_OTHER)));
+  }
+  return codec::RedisValue(std::move(result));
+}
+
+codec::RedisValue CountersHandler::metricsCommand(const std::vector<std::string>& cmd, rocksdb::WriteBatch* writeBatch,
+                                                  Context* ctx) {
+  std::vector<codec::RedisValue> result;
+  for (const auto& entry : CountersMetrics::snapshot()) {
+    result.emplace_back(std::string(entry.first));
+    result.emplace_back(entry.second);
+  }
+  return codec::RedisValue(std::move(result));
+}
+
+codec::RedisValue CountersHandler::mincrbyCommand(const std::vector<std::string>& cmd, rocksdb::WriteBatch* writeBatch,
+                                                  Context* ctx) {
+  int64_t delta = 0;
+  int64_t flags = 0;
+  try {
+    delta = folly::to<int64_t>(cmd[2]);
+    if (cmd.size() > 3) flags = folly::to<int64_t>(cmd[3]);
+  } catch (std::range_error&) {
+    return errorInvalidInteger();
+  }
+
+  std::vector<std::string> suffixes;
+  std::vector<std::string> keys;
+  CountersTimespans::instance().forEachTimespan(
+      cmd[1], flags, [&cmd, &suffixes, &keys](const CountersTimespans::Timespan& timespan) {
+        suffixes.push_back(timespan.keySuffix);
+        keys.push_back(cmd[1] + timespan.keySuffix);
+      });
+  if (keys.empty()) {
+    return errorResp("MINCRBY flags select no timespan");
+  }
+
+  std::string value = CountersValue::encode(delta);
+  std::vector<rocksdb::Slice> keySlices;
+  for (const auto& key : keys) {
+    writeBatch->Merge(key, value);
+    keySlices.emplace_back(key);
+  }
+  // same race condition caveat as incrby applies here, read all timespans in one go
+  std::vector<std::string> prevValues;
+  std::vector<rocksdb::Status> statuses = db()->MultiGet(rocksdb::ReadOptions(), keySlices, &prevValues);
+
+  std::vector<codec::RedisValue> result;
+  for (size_t i = 0; i < keys.size(); i++) {
+    int64_t prevInt = 0;
+    if (statuses[i].ok()) {
+      CHECK(CountersValue::decode(prevValues[i], &prevInt));
+    } else if (!statuses[i].IsNotFound()) {
+      return errorResp(folly::sformat("RocksDB error: {}", statuses[i].ToString()));
+    }
+    result.emplace_back(std::move(suffixes[i]));
+    result.emplace_back(prevInt + delta);
+  }
+  return codec::RedisValue(std::move(result));
+}
+
+codec::RedisValue CountersHandler::prefixscanCommand(const std::vector<std::string>& cmd,
+                                                     rocksdb::WriteBatch* writeBatch, Context* ctx) {
+  const std::string& prefix = cmd[1];
+  if (prefix.empty()) {
+    return { codec::RedisValue::Type::kError, "PREFIXSCAN prefix must not be empty" };
+  }
+  std::string startKey = prefix;
+  if (cmd[2] != "0") {
+    try {
+      startKey = folly::unhexlify(cmd[2]);
+    } catch (std::domain_error&) {
+      return { codec::RedisValue::Type::kError, "PREFIXSCAN invalid cursor" };
+    }
+    if (!boost::starts_with(startKey, prefix)) {
+      return { codec::RedisValue::Type::kError, "PREFIXSCAN invalid cursor" };
+    }
+  }
+
+  int64_t count = kDefaultScanCount;
+  bool withSum = false;
+  for (size_t i = 3; i < cmd.size(); i++) {
+    if (boost::iequals(cmd[i], "sum")) {
+      withSum = true;
+    } else if (boost::iequals(cmd[i], "count") && i + 1 < cmd.size()) {
+      try {
+        count = folly::to<int64_t>(cmd[++i]);
+      } catch (std::range_error&) {
+        return errorInvalidInteger();
+      }
+    } else {
+      return { codec::RedisValue::Type::kError, "PREFIXSCAN syntax error" };
+    }
+  }
+  if (count <= 0) {
+    return { codec::RedisValue::Type::kError, "PREFIXSCAN count must be positive" };
+  }
+  int64_t maxCount = withSum ? kMaxScanSumCount : kMaxScanCount;
+  count = std::min(count, maxCount);
+
+  // The smallest key greater than every key starting with prefix, unless prefix is all 0xff bytes
+  std::string upperBound = prefix;
+  while (!upperBound.empty() && static_cast<uint8_t>(upperBound.back()) == 0xff) {
+    upperBound.pop_back();
+  }
+  rocksdb::Slice upperBoundSlice;
+  rocksdb::ReadOptions readOptions;
+  // Scans must not evict the working set of point lookups from the block cache
+  readOptions.fill_cache = false;
+  if (!upperBound.empty()) {
+    upperBound.back()++;
+    upperBoundSlice = rocksdb::Slice(upperBound);
+    readOptions.iterate_upper_bound = &upperBoundSlice;
+  }
+
+  // The iterator only lives for one page, so it never pins memtables or versions for long
+  std::unique_ptr<rocksdb::Iterator> iter(db()->NewIterator(readOptions));
+  std::vector<codec::RedisValue> items;
+  int64_t sum = 0;
+  int64_t visited = 0;
+  for (iter->Seek(startKey); iter->Valid() && visited < count; iter->Next(), visited++) {
+    int64_t intValue = 0;
+    if (!CountersValue::decode(iter->value(), &intValue)) continue;  // not a counter
+    if (withSum) {
+      sum += intValue;
+    } else {
+      items.emplace_back(iter->key().ToString());
+      items.emplace_back(intValue);
+    }
+  }
+  if (!iter->status().ok()) {
+    return errorResp(folly::sformat("RocksDB error: {}", iter->status().ToString()));
+  }
+
+  std::vector<codec::RedisValue> result;
+  result.emplace_back(iter->Valid() ? folly::hexlify(iter->key().ToString()) : std::string("0"));
+  if (withSum) {
+    result.emplace_back(sum);
+  } else {
+    result.emplace_back(std::move(items));
+  }
+  return codec::RedisValue(std::move(result));
+}
+
+codec::RedisValue CountersHandler::slowlogCommand(const std::vector<std::string>& cmd, rocksdb::WriteBatch* writeBatch,
+                                                  Context* ctx) {
+  CountersSlowLog* slowLog = CountersSlowLog::instance();
+  if (boost::iequals(cmd[1], "len") && cmd.size() == 2) {
+    return codec::RedisValue(static_cast<int64_t>(slowLog->len()));
+  } else if (boost::iequals(cmd[1], "reset") && cmd.size() == 2) {
+    slowLog->reset();
+    return simpleStringOk();
+  } else if (!boost::iequals(cmd[1], "get")) {
+    return { codec::RedisValue::Type::kError, "SLOWLOG subcommand must be GET, LEN or RESET" };
+  }
+
+  int64_t count = kDefaultSlowlogCount;
+  if (cmd.size() > 2) {
+    try {
+      count = folly::to<int64_t>(cmd[2]);
+    } catch (std::range_error&) {
+      return errorInvalidInteger();
+    }
+  }
+  std::vector<codec::RedisValue> result;
+  for (auto& entry : slowLog->get(static_cast<size_t>(std::max(count, 0L)))) {
+    std::vector<codec::RedisValue> args;
+    for (auto& arg : entry.cmd) {
+      args.emplace_back(std::move(arg));
+    }
+    std::vector<codec::RedisValue> stats;
+    for (auto& stat : entry.stats) {
+      stats.emplace_back(std::move(stat.first));
+      stats.emplace_back(static_cast<int64_t>(stat.second));
+    }
+    std::vector<codec::RedisValue> item;
+    item.emplace_back(entry.id);
+    item.emplace_back(entry.timestampMs / 1000);
+    item.emplace_back(entry.durationUs);
+    item.emplace_back(std::move(args));
+    item.emplace_back(std::move(stats));
+    result.emplace_back(std::move(item));
+  }
+  return codec::RedisValue(std::move(result));
+}
+
 codec::RedisValue CountersHandler::setCommand(const std::vector<std::string>& cmd, rocksdb::WriteBatch* writeBatch,
                                               Context* ctx) {
   rocksdb::Slice key = rocksdb::Slice(cmd[1]);
   try {
-    boost::endian::big_int64_buf_t value(folly::to<int64_t>(cmd[2]));
-    writeBatch->Put(key, rocksdb::Slice(value.data(), sizeof(int64_t)));
+    writeBatch->Put(key, CountersValue::encode(folly::to<int64_t>(cmd[2])));
   } catch (std::range_error&) {
     return errorInvalidInteger();
   }
@@ -3,25 +3,45 @@
 
 #include <memory>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include "codec/RedisValue.h"
+#include "counters/CountersCommandExecutor.h"
+#include "counters/CountersGroupCommit.h"
+#include "counters/CountersMemory.h"
 #include "counters/IncrbyMergeOperator.h"
 #include "counters/ZeroValueCompactionFilter.h"
+#include "folly/futures/Future.h"
+#include "folly/io/async/EventBase.h"
 #include "pipeline/TransactionalRedisHandler.h"
 #include "rocksdb/cache.h"
 #include "rocksdb/filter_policy.h"
 #include "rocksdb/options.h"
+#include "rocksdb/statistics.h"
 #include "rocksdb/table.h"
 #include "rocksdb/write_batch.h"
 
 namespace counters {
 
-class CountersHandler : public pipeline::TransactionalRedisHandler {
+class CountersHandler : public pipeline::TransactionalRedisHandler,
+                        public std::enable_shared_from_this<CountersHandler> {
  public:
+  // When executor is given, single-key commands outside of transactions are dispatched to it by key hash instead of
+  // running inline on the connection's IO thread. Replies are still written in request order. Executor tasks keep the
+  // handler alive until they finish, so it must be owned by a shared_ptr.
   CountersHandler(std::shared_ptr<pipeline::DatabaseManager> databaseManager,
-                  std::shared_ptr<infra::kafka::ConsumerHelper> consumerHelper)
-      : TransactionalRedisHandler(databaseManager, consumerHelper) {}
+                  std::shared_ptr<infra::kafka::ConsumerHelper> consumerHelper,
+                  std::shared_ptr<CountersCommandExecutor> executor = nullptr)
+      : TransactionalRedisHandler(databaseManager, consumerHelper),
+        executor_(std::move(executor)),
+        replyChain_(folly::makeFuture()),
+        pendingReplies_(0),
+        inTransaction_(false),
+        closed_(false) {}
+
+  // Replies still pending once the connection is gone are dropped instead of written
+  void detachPipeline(Context* ctx) override;
 
   static void optimizeColumnFamily(int defaultBlockCacheSizeMb, rocksdb::ColumnFamilyOptions* options) {
     options->compaction_filter = new ZeroValueCompactionFilter();
@@ -30,28 +50,114 @@ class CountersHandler : public pipeline::TransactionalRedisHandler {
     rocksdb::BlockBasedTableOptions block_based_options;
     block_based_options.index_type = rocksdb::BlockBasedTableOptions::kBinarySearch;
     block_based_options.filter_policy.reset(rocksdb::NewBloomFilterPolicy(10));
-    block_based_options.block_cache = rocksdb::NewLRUCache(static_cast<size_t>(defaultBlockCacheSizeMb * 1024 * 1024));
+    block_based_options.block_cache = CountersMemory::blockCache(defaultBlockCacheSizeMb);
+    if (CountersMemory::hasBudget()) {
+      // charge index and filter blocks to the cache as well, keeping the hot L0 ones from being evicted
+      block_based_options.cache_index_and_filter_blocks = true;
+      block_based_options.pin_l0_filter_and_index_blocks_in_cache = true;
+    }
     options->table_factory.reset(rocksdb::NewBlockBasedTableFactory(block_based_options));
     options->memtable_prefix_bloom_size_ratio = 0.02;
   }
 
+  static void optimizeDatabase(rocksdb::DBOptions* options) {
+    // memtables of all column families count against the memory budget through the block cache
+    options->write_buffer_manager = CountersMemory::writeBufferManager();
+    // write statistics show how often RocksDB actually merged the writes the group commit lined up
+    if (CountersGroupCommit::enabled() && !options->statistics) {
+      options->statistics = rocksdb::CreateDBStatistics();
+    }
+  }
+
   const TransactionalCommandHandlerTable& getTransactionalCommandHandlerTable() const override {
-    static const TransactionalCommandHandlerTable table(mergeWithDefaultTransactionalCommandHandlerTable({
-      { "ensure", { static_cast<TransactionalCommandHandlerFunc>(&CountersHandler::ensureCommand), 2, 2 } },
-      { "get", { static_cast<TransactionalCommandHandlerFunc>(&CountersHandler::getCommand), 1, 1 } },
-      { "incrby", { static_cast<TransactionalCommandHandlerFunc>(&CountersHandler::incrbyCommand), 2, 2 } },
-      { "set", { static_cast<TransactionalCommandHandlerFunc>(&CountersHandler::setCommand), 2, 2 } },
-    }));
+    static const TransactionalCommandHandlerTable table([this]() {
+      TransactionalCommandHandlerTable commands;
+      for (const auto& entry : getCountersCommandTable()) {
+        const CountersCommandInfo& info = entry.second;
+        commands.insert(
+            { entry.first, { static_cast<TransactionalCommandHandlerFunc>(info.func), info.minArgs, info.maxArgs } });
+      }
+      return mergeWithDefaultTransactionalCommandHandlerTable(commands);
+    }());
     return table;
   }
 
+ protected:
+  bool handleCommand(int64_t key, const std::string& cmdNameLower, const std::vector<std::string>& cmd,
+                     Context* ctx) override;
+
+  // Event base of the connection, which replies of commands run on the executor are written from
+  virtual folly::EventBase* getEventBase(Context* ctx);
+
  private:
   using TransactionalCommandHandlerFunc = pipeline::TransactionalRedisHandler::TransactionalCommandHandlerFunc;
 
+  using CountersCommandFunc = codec::RedisValue (CountersHandler::*)(const std::vector<std::string>& cmd,
+                                                                      rocksdb::WriteBatch* writeBatch, Context* ctx);
+
+  struct CountersCommandInfo {
+    CountersCommandFunc func;
+    int minArgs;
+    int maxArgs;
+    // Keyed by its first argument, so that it may run on the executor shard owning that key. Only commands touching
+    // no other key may be keyed, or later commands of the connection on those keys could overtake their writes.
+    bool keyed;
+  };
+  using CountersCommandTable = std::unordered_map<std::string, CountersCommandInfo>;
+
+  static const CountersCommandTable& getCountersCommandTable() {
+    static const CountersCommandTable table({
+      { "ensure", { &CountersHandler::ensureCommand, 2, 2, true } },
+      { "get", { &CountersHandler::getCommand, 1, 1, true } },
+      { "incrby", { &CountersHandler::incrbyCommand, 2, 2, true } },
+      { "memory", { &CountersHandler::memoryCommand, 0, 0, false } },
+      { "metrics", { &CountersHandler::metricsCommand, 0, 0, false } },
+      { "mincrby", { &CountersHandler::mincrbyCommand, 2, 3, false } },
+      { "prefixscan", { &CountersHandler::prefixscanCommand, 2, 5, false } },
+      { "set", { &CountersHandler::setCommand, 2, 2, true } },
+      { "slowlog", { &CountersHandler::slowlogCommand, 1, 2, false } },
+    });
+    return table;
+  }
+
+  // Run a command through the transactional handler, profiling it for the slow log when sampled
+  bool runCommand(int64_t key, const std::string& cmdNameLower, const std::vector<std::string>& cmd, Context* ctx);
+  // Run a command on the executor and queue its reply behind all earlier replies of this connection
+  void dispatchAsync(const CountersCommandInfo& info, const std::vector<std::string>& cmd, Context* ctx);
+  // Run a command inline once all earlier replies of this connection have been written
+  bool handleInOrder(int64_t key, const std::string& cmdNameLower, const std::vector<std::string>& cmd,
+                     Context* ctx);
+
   codec::RedisValue ensureCommand(const std::vector<std::string>& cmd, rocksdb::WriteBatch* writeBatch, Context* ctx);
   codec::RedisValue getCommand(const std::vector<std::string>& cmd, rocksdb::WriteBatch* writeBatch, Context* ctx);
   codec::RedisValue incrbyCommand(const std::vector<std::string>& cmd, rocksdb::WriteBatch* writeBatch, Context* ctx);
+  codec::RedisValue memoryCommand(const std::vector<std::string>& cmd, rocksdb::WriteBatch* writeBatch, Context* ctx);
+  codec::RedisValue metricsCommand(const std::vector<std::string>& cmd, rocksdb::WriteBatch* writeBatch, Context* ctx);
+  // Increment every timespan key selected by flags, the same way the increment kafka consumer applies a record
+  codec::RedisValue mincrbyCommand(const std::vector<std::string>& cmd, rocksdb::WriteBatch* writeBatch,
+                                   Context* ctx);
+  // PREFIXSCAN prefix cursor [COUNT n] [SUM]
+  // Page through counters whose keys start with prefix. A cursor of "0" starts a scan and is returned when it ends.
+  // With SUM, the page is reduced to the sum of its values, which allows larger pages. Scans span shards, so they run
+  // inline on the IO thread and pages stay small enough not to stall it on uncached blocks.
+  codec::RedisValue prefixscanCommand(const std::vector<std::string>& cmd, rocksdb::WriteBatch* writeBatch,
+                                      Context* ctx);
   codec::RedisValue setCommand(const std::vector<std::string>& cmd, rocksdb::WriteBatch* writeBatch, Context* ctx);
+  // SLOWLOG GET [count] | LEN | RESET
+  codec::RedisValue slowlogCommand(const std::vector<std::string>& cmd, rocksdb::WriteBatch* writeBatch, Context* ctx);
+
+  static constexpr int64_t kDefaultScanCount = 100;
+  static constexpr int64_t kMaxScanCount = 1000;
+  static constexpr int64_t kMaxScanSumCount = 10000;
+  static constexpr int64_t kDefaultSlowlogCount = 10;
+
+  std::shared_ptr<CountersCommandExecutor> executor_;
+  // The following are only accessed from the connection's event base thread
+  folly::Future<folly::Unit> replyChain_;
+  size_t pendingReplies_;
+  bool inTransaction_;
+  // Set once the pipeline is detached, so that pending reply callbacks become no-ops
+  bool closed_;
 };
 
 }  // namespace counters
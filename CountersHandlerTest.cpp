@@ -1,9 +1,20 @@
+#include <atomic>
+#include <chrono>
+#include <future>
 #include <memory>
 #include <string>
+#include <thread>
+#include <utility>
 #include <vector>
 
 #include "codec/RedisMessage.h"
+#include "counters/CountersCommandExecutor.h"
 #include "counters/CountersHandler.h"
+#include "counters/CountersSlowLog.h"
+#include "counters/CountersValue.h"
+#include "folly/futures/Future.h"
+#include "folly/io/async/EventBase.h"
+#include "gflags/gflags.h"
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
 #include "rocksdb/options.h"
@@ -11,6 +22,9 @@
 #include "rocksdb/status.h"
 #include "stesting/TestWithRocksDb.h"
 
+DECLARE_int32(counters_slowlog_sample_rate);
+DECLARE_int64(counters_slowlog_threshold_us);
+
 namespace counters {
 
 class CountersHandlerTest : public stesting::TestWithRocksDb {
@@ -18,7 +32,7 @@ class CountersHandlerTest : public stesting::TestWithRocksDb {
   CountersHandlerTest()
     : stesting::TestWithRocksDb({}, {{"default", CountersHandler::optimizeColumnFamily}}) {}
 
-  // Counters does not support async command handling, so use default key
+  // Commands run inline without an executor in tests, so use default key
   codec::RedisMessage getRedisMessage(codec::RedisValue&& val) {
     return codec::RedisMessage(std::move(val));
   }
@@ -31,10 +45,85 @@ class MockCountersHandler : public CountersHandler {
 
   MOCK_METHOD2(write, folly::Future<folly::Unit>(Context*, codec::RedisMessage));
 
-  // Counters does not support async command handling, so use default key
+  // Commands run inline without an executor in tests, so use default key
+  bool handleCommand(const std::string& cmdNameLower, const std::vector<std::string>& cmd, Context* ctx) {
+    return CountersHandler::handleCommand(0L, cmdNameLower, cmd, ctx);
+  }
+};
+
+// Runs keyed commands on an executor and writes their replies from a test event base
+class AsyncMockCountersHandler : public CountersHandler {
+ public:
+  AsyncMockCountersHandler(std::shared_ptr<pipeline::DatabaseManager> databaseManager,
+                           std::shared_ptr<CountersCommandExecutor> executor, folly::EventBase* eventBase)
+      : CountersHandler(databaseManager, nullptr, std::move(executor)), eventBase_(eventBase) {}
+
+  MOCK_METHOD2(write, folly::Future<folly::Unit>(Context*, codec::RedisMessage));
+
   bool handleCommand(const std::string& cmdNameLower, const std::vector<std::string>& cmd, Context* ctx) {
     return CountersHandler::handleCommand(0L, cmdNameLower, cmd, ctx);
   }
+
+ protected:
+  folly::EventBase* getEventBase(Context* ctx) override {
+    return eventBase_;
+  }
+
+ private:
+  folly::EventBase* eventBase_;
+};
+
+class CountersHandlerAsyncTest : public CountersHandlerTest {
+ protected:
+  CountersHandlerAsyncTest()
+      : executor_(std::make_shared<CountersCommandExecutor>(4)),
+        replies_(0),
+        unblocked_(unblock_.get_future().share()) {}
+
+  ~CountersHandlerAsyncTest() {
+    unblock();
+  }
+
+  // Hold back all commands on the executor shard owning key until unblock is called
+  void block(const std::string& key) {
+    std::shared_future<void> unblocked = unblocked_;
+    executor_->submit(key, [unblocked]() {
+      unblocked.wait();
+      return codec::RedisValue::nullString();
+    });
+  }
+
+  void unblock() {
+    if (!unblockedCalled_) unblock_.set_value();
+    unblockedCalled_ = true;
+  }
+
+  // Expect a reply, counting it once written
+  void expectReply(AsyncMockCountersHandler* handler, codec::RedisValue&& val) {
+    EXPECT_CALL(*handler, write(nullptr, getRedisMessage(std::move(val))))
+        .WillOnce(testing::InvokeWithoutArgs([this]() {
+          replies_++;
+          return folly::makeFuture();
+        }));
+  }
+
+  // Run the event base until count replies were written or the timeout ran out
+  void waitForReplies(int count, std::chrono::milliseconds timeout = std::chrono::milliseconds(5000)) {
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    while (replies_ < count && std::chrono::steady_clock::now() < deadline) {
+      eventBase_.loopOnce(EVLOOP_NONBLOCK);
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  }
+
+  folly::EventBase eventBase_;
+  std::shared_ptr<CountersCommandExecutor> executor_;
+  std::atomic<int> replies_;
+
+ private:
+  std::promise<void> unblock_;
+  std::shared_future<void> unblocked_;
+  bool unblockedCalled_ = false;
 };
 
 TEST_F(CountersHandlerTest, EnsureCommand) {
@@ -109,6 +198,84 @@ TEST_F(CountersHandlerTest, IncrbyCommand) {
   EXPECT_TRUE(handler.handleCommand("incrby", { "incrby", "key2", "-5" }, nullptr));
 }
 
+TEST_F(CountersHandlerTest, MincrbyCommand) {
+  MockCountersHandler handler(databaseManager());
+
+  // seed values
+  boost::endian::big_int64_buf_t value1(10);
+  db()->Put(rocksdb::WriteOptions(), "key1H", rocksdb::Slice(value1.data(), sizeof(int64_t)));
+
+  // value not a valid integer
+  EXPECT_CALL(handler, write(nullptr, getRedisMessage(codec::RedisValue(codec::RedisValue::Type::kError,
+                                                                        "Value is not an integer or out of range"))))
+      .Times(1);
+  EXPECT_TRUE(handler.handleCommand("mincrby", { "mincrby", "key1", "a" }, nullptr));
+
+  // default timespans
+  EXPECT_CALL(handler, write(nullptr, getRedisMessage(codec::RedisValue(std::vector<codec::RedisValue>{
+                                          codec::RedisValue(std::string("H")), codec::RedisValue(15),
+                                          codec::RedisValue(std::string("D")), codec::RedisValue(5),
+                                          codec::RedisValue(std::string("W")), codec::RedisValue(5),
+                                          codec::RedisValue(std::string("M")), codec::RedisValue(5),
+                                      }))))
+      .Times(1);
+  EXPECT_TRUE(handler.handleCommand("mincrby", { "mincrby", "key1", "5" }, nullptr));
+
+  // explicit flags for hour and total
+  EXPECT_CALL(handler, write(nullptr, getRedisMessage(codec::RedisValue(std::vector<codec::RedisValue>{
+                                          codec::RedisValue(std::string("H")), codec::RedisValue(12),
+                                          codec::RedisValue(std::string("T")), codec::RedisValue(-3),
+                                      }))))
+      .Times(1);
+  EXPECT_TRUE(handler.handleCommand("mincrby", { "mincrby", "key1", "-3", "17" }, nullptr));
+}
+
+TEST_F(CountersHandlerTest, PrefixscanCommand) {
+  MockCountersHandler handler(databaseManager());
+
+  // seed values
+  boost::endian::big_int64_buf_t value1(1);
+  boost::endian::big_int64_buf_t value2(2);
+  db()->Put(rocksdb::WriteOptions(), "a1", rocksdb::Slice(value1.data(), sizeof(int64_t)));
+  db()->Put(rocksdb::WriteOptions(), "a2", rocksdb::Slice(value2.data(), sizeof(int64_t)));
+  db()->Put(rocksdb::WriteOptions(), "b1", rocksdb::Slice(value1.data(), sizeof(int64_t)));
+
+  // full scan in a single page
+  EXPECT_CALL(handler, write(nullptr, getRedisMessage(codec::RedisValue(std::vector<codec::RedisValue>{
+                                          codec::RedisValue(std::string("0")),
+                                          codec::RedisValue(std::vector<codec::RedisValue>{
+                                              codec::RedisValue(std::string("a1")), codec::RedisValue(1),
+                                              codec::RedisValue(std::string("a2")), codec::RedisValue(2),
+                                          }),
+                                      }))))
+      .Times(1);
+  EXPECT_TRUE(handler.handleCommand("prefixscan", { "prefixscan", "a", "0" }, nullptr));
+
+  // paging returns the hex-encoded next key as cursor
+  EXPECT_CALL(handler, write(nullptr, getRedisMessage(codec::RedisValue(std::vector<codec::RedisValue>{
+                                          codec::RedisValue(std::string("6132")),
+                                          codec::RedisValue(std::vector<codec::RedisValue>{
+                                              codec::RedisValue(std::string("a1")), codec::RedisValue(1),
+                                          }),
+                                      }))))
+      .Times(1);
+  EXPECT_TRUE(handler.handleCommand("prefixscan", { "prefixscan", "a", "0", "count", "1" }, nullptr));
+
+  // sum from the cursor
+  EXPECT_CALL(handler, write(nullptr, getRedisMessage(codec::RedisValue(std::vector<codec::RedisValue>{
+                                          codec::RedisValue(std::string("0")), codec::RedisValue(2),
+                                      }))))
+      .Times(1);
+  EXPECT_TRUE(handler.handleCommand("prefixscan", { "prefixscan", "a", "6132", "sum" }, nullptr));
+
+  // cursor outside of prefix
+  EXPECT_CALL(handler,
+              write(nullptr, getRedisMessage(codec::RedisValue(codec::RedisValue::Type::kError,
+                                                               "PREFIXSCAN invalid cursor"))))
+      .Times(1);
+  EXPECT_TRUE(handler.handleCommand("prefixscan", { "prefixscan", "a", "6231" }, nullptr));
+}
+
 TEST_F(CountersHandlerTest, SetCommand) {
   MockCountersHandler handler(databaseManager());
 
@@ -190,4 +357,223 @@ TEST_F(CountersHandlerTest, IncrbyMergeOperator) {
   EXPECT_EQ(0, intNewValue4);
 }
 
+TEST_F(CountersHandlerTest, CompactValueEncoding) {
+  MockCountersHandler handler(databaseManager());
+
+  // legacy values written before compact encoding was turned on
+  boost::endian::big_int64_buf_t value1(10);
+  db()->Put(rocksdb::WriteOptions(), "key1", rocksdb::Slice(value1.data(), sizeof(int64_t)));
+
+  FLAGS_counters_compact_value_encoding = true;
+  EXPECT_CALL(handler, write(nullptr, getRedisMessage(codec::RedisValue(11)))).Times(1);
+  EXPECT_TRUE(handler.handleCommand("incrby", { "incrby", "key1", "1" }, nullptr));
+  EXPECT_CALL(handler, write(nullptr, getRedisMessage(codec::RedisValue(-1)))).Times(1);
+  EXPECT_TRUE(handler.handleCommand("incrby", { "incrby", "key2", "-1" }, nullptr));
+
+  // merged and compacted values are rewritten in the compact format
+  db()->CompactRange(rocksdb::CompactRangeOptions(), nullptr, nullptr);
+  std::string newValue1;
+  EXPECT_TRUE(db()->Get(rocksdb::ReadOptions(), "key1", &newValue1).ok());
+  EXPECT_EQ(2UL, newValue1.size());
+  int64_t intNewValue1 = 0;
+  EXPECT_TRUE(CountersValue::decode(newValue1, &intNewValue1));
+  EXPECT_EQ(11, intNewValue1);
+
+  // both formats stay readable once compact encoding is turned off again
+  FLAGS_counters_compact_value_encoding = false;
+  EXPECT_CALL(handler, write(nullptr, getRedisMessage(codec::RedisValue(11)))).Times(1);
+  EXPECT_TRUE(handler.handleCommand("get", { "get", "key1" }, nullptr));
+  EXPECT_CALL(handler, write(nullptr, getRedisMessage(codec::RedisValue(-1)))).Times(1);
+  EXPECT_TRUE(handler.handleCommand("get", { "get", "key2" }, nullptr));
+
+  // and compactions rewrite compact values back to the fixed format, so that older binaries can read them
+  db()->CompactRange(rocksdb::CompactRangeOptions(), nullptr, nullptr);
+  for (const char* key : { "key1", "key2" }) {
+    std::string value;
+    EXPECT_TRUE(db()->Get(rocksdb::ReadOptions(), key, &value).ok());
+    EXPECT_EQ(sizeof(int64_t), value.size());
+    EXPECT_TRUE(CountersValue::isFixed(value));
+  }
+
+  // round trips, including the sizes that fall back to the fixed format
+  FLAGS_counters_compact_value_encoding = true;
+  for (int64_t value : { 0L, 1L, -1L, 63L, -64L, 1L << 41, -(1L << 41), INT64_MAX, INT64_MIN }) {
+    std::string encoded = CountersValue::encode(value);
+    int64_t decoded = 0;
+    EXPECT_TRUE(CountersValue::decode(encoded, &decoded));
+    EXPECT_EQ(value, decoded);
+  }
+  FLAGS_counters_compact_value_encoding = false;
+}
+
+TEST_F(CountersHandlerTest, SlowlogCommand) {
+  MockCountersHandler handler(databaseManager());
+
+  EXPECT_CALL(handler,
+              write(nullptr, getRedisMessage(codec::RedisValue(codec::RedisValue::Type::kSimpleString, "OK"))))
+      .Times(1);
+  EXPECT_TRUE(handler.handleCommand("slowlog", { "slowlog", "reset" }, nullptr));
+
+  // profile every command regardless of its latency
+  FLAGS_counters_slowlog_sample_rate = 1;
+  FLAGS_counters_slowlog_threshold_us = 0;
+  EXPECT_CALL(handler, write(nullptr, getRedisMessage(codec::RedisValue::nullString()))).Times(1);
+  EXPECT_TRUE(handler.handleCommand("get", { "get", "key1" }, nullptr));
+  EXPECT_CALL(handler, write(nullptr, getRedisMessage(codec::RedisValue(1)))).Times(1);
+  EXPECT_TRUE(handler.handleCommand("slowlog", { "slowlog", "len" }, nullptr));
+  FLAGS_counters_slowlog_sample_rate = 0;
+
+  std::vector<CountersSlowLog::Entry> entries = CountersSlowLog::instance()->get(10);
+  ASSERT_EQ(2UL, entries.size());
+  EXPECT_EQ(std::vector<std::string>({ "slowlog", "len" }), entries[0].cmd);
+  EXPECT_EQ(std::vector<std::string>({ "get", "key1" }), entries[1].cmd);
+  EXPECT_FALSE(entries[1].stats.empty());
+}
+
+TEST_F(CountersHandlerAsyncTest, RepliesInRequestOrder) {
+  auto handler = std::make_shared<AsyncMockCountersHandler>(databaseManager(), executor_, &eventBase_);
+  block("key1");
+
+  {
+    testing::InSequence sequence;
+    expectReply(handler.get(), codec::RedisValue(1));
+    expectReply(handler.get(), codec::RedisValue(2));
+    expectReply(handler.get(), codec::RedisValue(codec::RedisValue::Type::kSimpleString, "OK"));
+    expectReply(handler.get(), codec::RedisValue(3));
+    expectReply(handler.get(), codec::RedisValue(11));
+  }
+  EXPECT_TRUE(handler->handleCommand("incrby", { "incrby", "key1", "1" }, nullptr));
+  EXPECT_TRUE(handler->handleCommand("incrby", { "incrby", "key2", "2" }, nullptr));
+  EXPECT_TRUE(handler->handleCommand("slowlog", { "slowlog", "reset" }, nullptr));
+  EXPECT_TRUE(handler->handleCommand("incrby", { "incrby", "key3", "3" }, nullptr));
+  EXPECT_TRUE(handler->handleCommand("incrby", { "incrby", "key1", "10" }, nullptr));
+
+  // replies of commands on other shards wait for the blocked first one
+  waitForReplies(1, std::chrono::milliseconds(100));
+  EXPECT_EQ(0, replies_);
+
+  unblock();
+  waitForReplies(5);
+  EXPECT_EQ(5, replies_);
+}
+
+TEST_F(CountersHandlerAsyncTest, InlineCommandWaitsForPendingReplies) {
+  auto handler = std::make_shared<AsyncMockCountersHandler>(databaseManager(), executor_, &eventBase_);
+  db()->Put(rocksdb::WriteOptions(), "key1", CountersValue::encode(5));
+  block("key1");
+
+  {
+    testing::InSequence sequence;
+    expectReply(handler.get(), codec::RedisValue(5));
+    expectReply(handler.get(), codec::RedisValue(codec::RedisValue::Type::kSimpleString, "OK"));
+  }
+  EXPECT_TRUE(handler->handleCommand("get", { "get", "key1" }, nullptr));
+  // not keyed, so it runs inline, but only after the reply to GET was written
+  EXPECT_TRUE(handler->handleCommand("slowlog", { "slowlog", "reset" }, nullptr));
+
+  waitForReplies(1, std::chrono::milliseconds(100));
+  EXPECT_EQ(0, replies_);
+
+  unblock();
+  waitForReplies(2);
+  EXPECT_EQ(2, replies_);
+}
+
+TEST_F(CountersHandlerAsyncTest, MincrbyVisibleToTimespanKeys) {
+  auto handler = std::make_shared<AsyncMockCountersHandler>(databaseManager(), executor_, &eventBase_);
+  block("key1");
+
+  {
+    testing::InSequence sequence;
+    EXPECT_CALL(*handler, write(nullptr, testing::_)).WillOnce(testing::InvokeWithoutArgs([this]() {
+      replies_++;
+      return folly::makeFuture();
+    }));
+    expectReply(handler.get(), codec::RedisValue(1));
+  }
+  // MINCRBY writes timespan keys other than its own, so a GET of one of them reads what it wrote
+  EXPECT_TRUE(handler->handleCommand("mincrby", { "mincrby", "key1", "1" }, nullptr));
+  EXPECT_TRUE(handler->handleCommand("get", { "get", "key1H" }, nullptr));
+
+  unblock();
+  waitForReplies(2);
+  EXPECT_EQ(2, replies_);
+}
+
+TEST_F(CountersHandlerAsyncTest, PrefixscanSeesPendingWrites) {
+  auto handler = std::make_shared<AsyncMockCountersHandler>(databaseManager(), executor_, &eventBase_);
+  block("a1");
+
+  {
+    testing::InSequence sequence;
+    expectReply(handler.get(), codec::RedisValue(5));
+    expectReply(handler.get(), codec::RedisValue(std::vector<codec::RedisValue>{
+                              codec::RedisValue(std::string("0")), codec::RedisValue(5),
+                          }));
+  }
+  // the scan spans shards, so it runs after the write it follows instead of on the shard owning its prefix
+  EXPECT_TRUE(handler->handleCommand("incrby", { "incrby", "a1", "5" }, nullptr));
+  EXPECT_TRUE(handler->handleCommand("prefixscan", { "prefixscan", "a", "0", "sum" }, nullptr));
+
+  unblock();
+  waitForReplies(2);
+  EXPECT_EQ(2, replies_);
+}
+
+TEST_F(CountersHandlerAsyncTest, ReleasedWhileCommandsRun) {
+  auto handler = std::make_shared<AsyncMockCountersHandler>(databaseManager(), executor_, &eventBase_);
+  block("key1");
+
+  // the connection goes away while its commands are still queued, so nothing is replied
+  EXPECT_CALL(*handler, write(nullptr, testing::_)).Times(0);
+  EXPECT_TRUE(handler->handleCommand("incrby", { "incrby", "key1", "5" }, nullptr));
+  EXPECT_TRUE(handler->handleCommand("slowlog", { "slowlog", "reset" }, nullptr));
+  handler->detachPipeline(nullptr);
+
+  // releasing the handler does not wait for the blocked command, which keeps it alive instead
+  std::weak_ptr<AsyncMockCountersHandler> released = handler;
+  handler.reset();
+  EXPECT_FALSE(released.expired());
+
+  unblock();
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(5000);
+  while (!released.expired() && std::chrono::steady_clock::now() < deadline) {
+    eventBase_.loopOnce(EVLOOP_NONBLOCK);
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  EXPECT_TRUE(released.expired());
+
+  // the command itself still ran
+  std::string value;
+  EXPECT_TRUE(db()->Get(rocksdb::ReadOptions(), "key1", &value).ok());
+  int64_t intValue = 0;
+  EXPECT_TRUE(CountersValue::decode(value, &intValue));
+  EXPECT_EQ(5, intValue);
+}
+
+TEST_F(CountersHandlerAsyncTest, TransactionsStayInline) {
+  auto handler = std::make_shared<AsyncMockCountersHandler>(databaseManager(), executor_, &eventBase_);
+  block("key1");
+
+  // everything between MULTI and EXEC is replied to right away, even though the shard owning key1 is blocked
+  EXPECT_CALL(*handler, write(nullptr, testing::_)).Times(3);
+  EXPECT_TRUE(handler->handleCommand("multi", { "multi" }, nullptr));
+  EXPECT_TRUE(handler->handleCommand("incrby", { "incrby", "key1", "5" }, nullptr));
+  EXPECT_TRUE(handler->handleCommand("exec", { "exec" }, nullptr));
+  testing::Mock::VerifyAndClearExpectations(handler.get());
+
+  std::string value;
+  EXPECT_TRUE(db()->Get(rocksdb::ReadOptions(), "key1", &value).ok());
+  int64_t intValue = 0;
+  EXPECT_TRUE(CountersValue::decode(value, &intValue));
+  EXPECT_EQ(5, intValue);
+
+  // and keyed commands go back to the executor afterwards
+  expectReply(handler.get(), codec::RedisValue(5));
+  EXPECT_TRUE(handler->handleCommand("get", { "get", "key1" }, nullptr));
+  unblock();
+  waitForReplies(1);
+  EXPECT_EQ(1, replies_);
+}
+
 }  // namespace counters
@@ -0,0 +1,178 @@
+#include "counters/CountersHotKeys.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <utility>
+
+#include "counters/CountersMetrics.h"
+#include "folly/String.h"
+#include "gflags/gflags.h"
+#include "glog/logging.h"
+#include "rocksdb/options.h"
+
+DEFINE_string(counters_hot_keys_file, "", "Local file persisting hot keys for block cache warmup; empty disables it");
+DEFINE_int32(counters_hot_keys_sample_rate, 16,
+             "Track one in this many reads when looking for hot keys; 0 disables tracking");
+DEFINE_int32(counters_hot_keys_max, 100000, "Maximum number of hot keys persisted for warmup");
+DEFINE_int32(counters_hot_keys_persist_interval_sec, 300, "How often hot keys are persisted");
+DEFINE_int32(counters_warmup_threads, 4, "Number of threads reading hot keys during block cache warmup");
+DEFINE_int32(counters_warmup_keys_per_sec, 50000, "Maximum rate of hot key reads during warmup; 0 is unlimited");
+
+namespace counters {
+
+CountersHotKeys* CountersHotKeys::instance() {
+  static CountersHotKeys hotKeys;
+  return &hotKeys;
+}
+
+CountersHotKeys::~CountersHotKeys() {
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    stopped_ = true;
+  }
+  cv_.notify_all();
+  if (thread_.joinable()) thread_.join();
+}
+
+void CountersHotKeys::recordRead(const std::string& key) {
+  if (FLAGS_counters_hot_keys_file.empty() || FLAGS_counters_hot_keys_sample_rate <= 0) return;
+  static thread_local uint64_t readCount = 0;
+  if (++readCount % FLAGS_counters_hot_keys_sample_rate != 0) return;
+
+  std::lock_guard<std::mutex> guard(mutex_);
+  readCounts_[key]++;
+  if (readCounts_.size() > 2 * static_cast<size_t>(FLAGS_counters_hot_keys_max)) {
+    prune();
+  }
+}
+
+void CountersHotKeys::start(rocksdb::DB* db) {
+  if (FLAGS_counters_hot_keys_file.empty()) return;
+  std::lock_guard<std::mutex> guard(mutex_);
+  if (started_) return;
+  started_ = true;
+  thread_ = std::thread([this, db]() { run(db); });
+}
+
+std::vector<std::string> CountersHotKeys::hotKeys() {
+  std::vector<std::pair<std::string, uint32_t>> entries;
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    entries.assign(readCounts_.begin(), readCounts_.end());
+  }
+  size_t count = std::min(entries.size(), static_cast<size_t>(FLAGS_counters_hot_keys_max));
+  std::partial_sort(entries.begin(), entries.begin() + count, entries.end(),
+                    [](const std::pair<std::string, uint32_t>& lhs, const std::pair<std::string, uint32_t>& rhs) {
+                      return lhs.second > rhs.second;
+                    });
+  std::vector<std::string> keys;
+  for (size_t i = 0; i < count; i++) {
+    keys.push_back(std::move(entries[i].first));
+  }
+  return keys;
+}
+
+void CountersHotKeys::run(rocksdb::DB* db) {
+  warmup(db);
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (!stopped_) {
+    cv_.wait_for(lock, std::chrono::seconds(FLAGS_counters_hot_keys_persist_interval_sec));
+    if (stopped_) break;
+    lock.unlock();
+    persist();
+    lock.lock();
+  }
+}
+
+void CountersHotKeys::warmup(rocksdb::DB* db) {
+  std::ifstream in(FLAGS_counters_hot_keys_file);
+  if (!in) {
+    LOG(INFO) << "No hot keys to warm up the block cache with at " << FLAGS_counters_hot_keys_file;
+    return;
+  }
+  std::vector<std::string> keys;
+  std::string line;
+  while (std::getline(in, line)) {
+    std::string key;
+    if (folly::unhexlify(line, key)) {
+      keys.push_back(std::move(key));
+    }
+  }
+
+  LOG(INFO) << "Warming up the block cache with " << keys.size() << " hot keys";
+  CountersMetrics::set("warmup.keys_total", keys.size());
+  CountersMetrics::set("warmup.keys_loaded", 0);
+  CountersMetrics::set("warmup.done", 0);
+  auto start = std::chrono::steady_clock::now();
+  std::atomic<size_t> nextKey(0);
+  std::vector<std::thread> threads;
+  int numThreads = std::max(FLAGS_counters_warmup_threads, 1);
+  for (int i = 0; i < numThreads; i++) {
+    threads.emplace_back([this, db, &keys, &nextKey, start]() {
+      rocksdb::ReadOptions readOptions;
+      readOptions.fill_cache = true;
+      std::string value;
+      for (size_t k = nextKey++; k < keys.size() && !stopped_; k = nextKey++) {
+        db->Get(readOptions, keys[k], &value);
+        CountersMetrics::add("warmup.keys_loaded", 1);
+        if (FLAGS_counters_warmup_keys_per_sec > 0) {
+          // hold the overall read rate so that warmup does not starve live traffic of disk bandwidth
+          auto due = start + std::chrono::microseconds(1000000L * (k + 1) / FLAGS_counters_warmup_keys_per_sec);
+          std::this_thread::sleep_until(due);
+        }
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  auto elapsedMs =
+      std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+  int64_t keysPerSec = static_cast<int64_t>(keys.size() * 1000 / std::max<int64_t>(elapsedMs, 1));
+  CountersMetrics::set("warmup.keys_per_sec", keysPerSec);
+  CountersMetrics::set("warmup.done", 1);
+  LOG(INFO) << "Warmed up the block cache with " << keys.size() << " hot keys in " << elapsedMs << "ms";
+}
+
+void CountersHotKeys::persist() {
+  std::vector<std::string> keys = hotKeys();
+  if (keys.empty()) return;
+
+  // write to a temporary file first so that a crash never leaves a truncated file behind
+  std::string tmpFile = FLAGS_counters_hot_keys_file + ".tmp";
+  {
+    std::ofstream out(tmpFile, std::ios::trunc);
+    for (const auto& key : keys) {
+      out << folly::hexlify(key) << '\n';
+    }
+    if (!out) {
+      LOG(WARNING) << "Writing hot keys to " << tmpFile << " failed";
+      return;
+    }
+  }
+  if (std::rename(tmpFile.c_str(), FLAGS_counters_hot_keys_file.c_str()) != 0) {
+    LOG(WARNING) << "Renaming " << tmpFile << " to " << FLAGS_counters_hot_keys_file << " failed";
+    return;
+  }
+  CountersMetrics::set("warmup.keys_persisted", keys.size());
+  DLOG(INFO) << "Persisted " << keys.size() << " hot keys";
+}
+
+void CountersHotKeys::prune() {
+  std::vector<std::pair<std::string, uint32_t>> entries(readCounts_.begin(), readCounts_.end());
+  size_t keep = static_cast<size_t>(FLAGS_counters_hot_keys_max);
+  std::nth_element(entries.begin(), entries.begin() + keep, entries.end(),
+                   [](const std::pair<std::string, uint32_t>& lhs, const std::pair<std::string, uint32_t>& rhs) {
+                     return lhs.second > rhs.second;
+                   });
+  readCounts_.clear();
+  for (size_t i = 0; i < keep; i++) {
+    readCounts_.emplace(std::move(entries[i].first), entries[i].second / 2 + 1);
+  }
+}
+
+}  // namespace counters
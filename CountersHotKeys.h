@@ -0,0 +1,55 @@
+#ifndef COUNTERS_COUNTERSHOTKEYS_H_
+#define COUNTERS_COUNTERSHOTKEYS_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "rocksdb/db.h"
+
+namespace counters {
+
+// Tracks the most frequently read keys and periodically persists them to a local file, so that after a restart the
+// block cache can be warmed up by reading them back before the hot set would have reloaded on its own.
+class CountersHotKeys {
+ public:
+  CountersHotKeys() {}
+  ~CountersHotKeys();
+
+  static CountersHotKeys* instance();
+
+  // Record a read of key. Only one in --counters_hot_keys_sample_rate reads is tracked, none if it is 0.
+  void recordRead(const std::string& key);
+
+  // Warm up the block cache from the persisted file and start persisting periodically in the background.
+  // Does nothing unless --counters_hot_keys_file is set, and only the first call has an effect.
+  void start(rocksdb::DB* db);
+
+  // Most read keys first, up to --counters_hot_keys_max
+  std::vector<std::string> hotKeys();
+
+  // Read all keys persisted in --counters_hot_keys_file to load their blocks into the cache
+  void warmup(rocksdb::DB* db);
+  // Replace --counters_hot_keys_file with the current hot keys
+  void persist();
+
+ private:
+  void run(rocksdb::DB* db);
+  // Keep the hottest keys and age their counts, so that keys which went cold eventually drop out
+  void prune();
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::unordered_map<std::string, uint32_t> readCounts_;
+  bool started_ = false;
+  std::atomic<bool> stopped_{false};
+  std::thread thread_;
+};
+
+}  // namespace counters
+
+#endif  // COUNTERS_COUNTERSHOTKEYS_H_
@@ -0,0 +1,98 @@
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "counters/CountersHandler.h"
+#include "counters/CountersHotKeys.h"
+#include "counters/CountersMetrics.h"
+#include "gflags/gflags.h"
+#include "gtest/gtest.h"
+#include "rocksdb/options.h"
+#include "stesting/TestWithRocksDb.h"
+
+DECLARE_string(counters_hot_keys_file);
+DECLARE_int32(counters_hot_keys_sample_rate);
+DECLARE_int32(counters_hot_keys_max);
+
+namespace counters {
+
+class CountersHotKeysTest : public stesting::TestWithRocksDb {
+ protected:
+  CountersHotKeysTest()
+    : stesting::TestWithRocksDb({}, {{"default", CountersHandler::optimizeColumnFamily}}) {
+    const char* tmpDir = std::getenv("TEST_TMPDIR");
+    FLAGS_counters_hot_keys_file = std::string(tmpDir ? tmpDir : "/tmp") + "/counters_hot_keys";
+    FLAGS_counters_hot_keys_sample_rate = 1;
+    FLAGS_counters_hot_keys_max = 2;
+    std::remove(FLAGS_counters_hot_keys_file.c_str());
+  }
+
+  ~CountersHotKeysTest() {
+    std::remove(FLAGS_counters_hot_keys_file.c_str());
+    FLAGS_counters_hot_keys_file = "";
+  }
+
+  static void read(CountersHotKeys* hotKeys, const std::string& key, int times) {
+    for (int i = 0; i < times; i++) {
+      hotKeys->recordRead(key);
+    }
+  }
+};
+
+TEST_F(CountersHotKeysTest, MostReadFirst) {
+  CountersHotKeys hotKeys;
+  read(&hotKeys, "key1", 3);
+  read(&hotKeys, "key2", 1);
+  read(&hotKeys, "key3", 2);
+  EXPECT_EQ(std::vector<std::string>({ "key1", "key3" }), hotKeys.hotKeys());
+}
+
+TEST_F(CountersHotKeysTest, PruneAgesCounts) {
+  CountersHotKeys hotKeys;
+  read(&hotKeys, "key1", 8);
+  read(&hotKeys, "key2", 4);
+  // going over twice the maximum keeps the hottest keys with their counts halved
+  read(&hotKeys, "key3", 1);
+  read(&hotKeys, "key4", 1);
+  read(&hotKeys, "key5", 1);
+  EXPECT_EQ(std::vector<std::string>({ "key1", "key2" }), hotKeys.hotKeys());
+
+  // so recent reads outweigh older ones
+  read(&hotKeys, "key6", 4);
+  EXPECT_EQ(std::vector<std::string>({ "key1", "key6" }), hotKeys.hotKeys());
+}
+
+TEST_F(CountersHotKeysTest, Disabled) {
+  CountersHotKeys hotKeys;
+  FLAGS_counters_hot_keys_sample_rate = 0;
+  read(&hotKeys, "key1", 3);
+  FLAGS_counters_hot_keys_sample_rate = 1;
+  FLAGS_counters_hot_keys_file = "";
+  read(&hotKeys, "key1", 3);
+  EXPECT_TRUE(hotKeys.hotKeys().empty());
+}
+
+TEST_F(CountersHotKeysTest, PersistAndWarmup) {
+  db()->Put(rocksdb::WriteOptions(), "key1", "1");
+  db()->Put(rocksdb::WriteOptions(), std::string("key\n2", 5), "2");
+
+  CountersHotKeys hotKeys;
+  read(&hotKeys, "key1", 2);
+  read(&hotKeys, std::string("key\n2", 5), 1);
+  hotKeys.persist();
+  std::ifstream in(FLAGS_counters_hot_keys_file);
+  ASSERT_TRUE(in.good());
+  // the temporary file was renamed into place
+  EXPECT_FALSE(std::ifstream(FLAGS_counters_hot_keys_file + ".tmp").good());
+
+  // a restarted process reads back every persisted key
+  CountersHotKeys restarted;
+  restarted.warmup(db());
+  EXPECT_EQ(2, CountersMetrics::get("warmup.keys_total"));
+  EXPECT_EQ(2, CountersMetrics::get("warmup.keys_loaded"));
+  EXPECT_EQ(1, CountersMetrics::get("warmup.done"));
+}
+
+}  // namespace counters
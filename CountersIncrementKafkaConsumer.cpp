@@ -3,9 +3,10 @@
 #include <string>
 #include <unordered_map>
 
-#include "boost/endian/buffers.hpp"
 #include "counters/CounterRecord.hh"
+#include "counters/CountersMemory.h"
 #include "counters/CountersTimespans.h"
+#include "counters/CountersValue.h"
 #include "folly/Format.h"
 #include "infra/AvroHelper.h"
 #include "rocksdb/write_batch.h"
@@ -13,19 +14,29 @@
 namespace counters {
 
 void CountersIncrementKafkaConsumer::processBatch(int timeoutMs) {
+  // let compaction catch up before adding more to its debt
+  backpressure_.throttle([this]() { return run(); });
   std::unordered_map<std::string, int64_t> counts;
-  int64_t prevOffset = lastProcessedOffset_;
   size_t count = consumeBatch(timeoutMs, &counts);
-  if (lastProcessedOffset_ > prevOffset) {
-    rocksdb::WriteBatch writeBatch;
-    for (const auto& entry : counts) {
-      boost::endian::big_int64_buf_t value(entry.second);
-      writeBatch.Merge(entry.first, rocksdb::Slice(value.data(), sizeof(int64_t)));
+  if (count == 0) {
+    // nothing left to read, so the lag of the last message read no longer applies
+    lastLagMs_ = 0;
+  }
+  if (catchUp_.update(lastLagMs_)) {
+    // Far behind the head of the log, so aggregate many batches into a single write and offset checkpoint
+    for (int round = 1; round < catchUp_.batchRounds() && run(); round++) {
+      backpressure_.throttle([this]() { return run(); });
+      size_t roundCount = consumeBatch(timeoutMs, &counts);
+      count += roundCount;
+      if (roundCount == 0) {
+        lastLagMs_ = 0;
+        break;
+      }
+      if (!catchUp_.update(lastLagMs_)) break;
     }
-    CHECK(consumerHelper()->commitNextProcessOffset(offsetKey(), lastProcessedOffset_ + 1, &writeBatch));
-    commitAsync();  // it's okay if commit failed, since the offset in kafkadb is the source of truth
-    DLOG(INFO) << "Batch processed " << count << " messages with " << counts.size() << " keys";
   }
+  commitCounts(&counts);
+  DLOG(INFO) << "Batch processed " << count << " messages";
 }
 
 void CountersIncrementKafkaConsumer::processOne(const RdKafka::Message& msg, void* opaque) {
@@ -33,14 +44,38 @@ void CountersIncrementKafkaConsumer::processOne(const RdKafka::Message& msg, voi
   Counter record;
   infra::AvroHelper::decode(msg.payload(), msg.len(), &record);
   std::string key(reinterpret_cast<const char*>(record.key.data()), record.key.size());
-  int64_t timespanFlags = record.flags ? record.flags : CountersTimespans::kDefaultTimespanFlags;
-  for (const auto& entry : CountersTimespans::kTimespanMap) {
-    const auto& timespan = entry.second;
-    if (timespanFlags & timespan.mask) {
-      (*counts)[key + timespan.keySuffix] += record.by;
+  CountersTimespans::instance().forEachTimespan(
+      key, record.flags, [this, counts, &key, &record](const CountersTimespans::Timespan& span) {
+        auto result = counts->emplace(key + span.keySuffix, 0);
+        result.first->second += record.by;
+        if (result.second) countsBytes_ += result.first->first.size() + kCountEntryOverheadBytes;
+      });
+  lastProcessedOffset_ = msg.offset();
+  RdKafka::MessageTimestamp timestamp = msg.timestamp();
+  if (timestamp.type != RdKafka::MessageTimestamp::MSG_TIMESTAMP_NOT_AVAILABLE) {
+    lastLagMs_ = CountersCatchUpMode::nowMs() - timestamp.timestamp;
+  }
+  if (buffer_.update(countsBytes_)) {
+    // this consumer holds its part of an exceeded memory budget, so write out what it aggregated before reading on
+    commitCounts(counts);
+  }
+}
+
+void CountersIncrementKafkaConsumer::commitCounts(std::unordered_map<std::string, int64_t>* counts) {
+  if (lastProcessedOffset_ > lastCommittedOffset_) {
+    rocksdb::WriteBatch writeBatch;
+    for (const auto& entry : *counts) {
+      writeBatch.Merge(entry.first, CountersValue::encode(entry.second));
     }
+    CountersGroupCommit::instance()->gather(true);
+    CHECK(consumerHelper()->commitNextProcessOffset(offsetKey(), lastProcessedOffset_ + 1, &writeBatch));
+    commitAsync();  // it's okay if commit failed, since the offset in kafkadb is the source of truth
+    DLOG(INFO) << "Committed " << counts->size() << " keys up to offset " << lastProcessedOffset_;
+    lastCommittedOffset_ = lastProcessedOffset_;
   }
-  lastProcessedOffset_ = msg.offset();
+  counts->clear();
+  countsBytes_ = 0;
+  buffer_.update(0);
 }
 
 }  // namespace counters
@@ -3,10 +3,16 @@
 
 #include <memory>
 #include <string>
+#include <unordered_map>
 
 #include "boost/algorithm/string/predicate.hpp"
+#include "counters/CountersBackpressure.h"
+#include "counters/CountersCatchUpMode.h"
+#include "counters/CountersGroupCommit.h"
+#include "counters/CountersMemory.h"
 #include "infra/kafka/Consumer.h"
 #include "librdkafka/rdkafkacpp.h"
+#include "rocksdb/db.h"
 
 namespace counters {
 
@@ -18,9 +24,15 @@ class CountersIncrementKafkaConsumer : public infra::kafka::Consumer {
 
   CountersIncrementKafkaConsumer(const std::string& brokerList, const std::string& topicStr, int partition,
                                  const std::string& groupId, const std::string& offsetKey, bool lowLatency,
-                                 std::shared_ptr<infra::kafka::ConsumerHelper> consumerHelper)
+                                 std::shared_ptr<infra::kafka::ConsumerHelper> consumerHelper, rocksdb::DB* db)
       : infra::kafka::Consumer(brokerList, topicStr, partition, groupId, offsetKey, lowLatency, consumerHelper),
-        lastProcessedOffset_(RdKafka::Topic::OFFSET_INVALID) {}
+        lastProcessedOffset_(RdKafka::Topic::OFFSET_INVALID),
+        lastCommittedOffset_(RdKafka::Topic::OFFSET_INVALID),
+        lastLagMs_(0),
+        countsBytes_(0),
+        buffer_(offsetKey),
+        catchUp_(offsetKey, db),
+        backpressure_(offsetKey, db, &groupCommitParticipant_) {}
 
   virtual ~CountersIncrementKafkaConsumer() {}
 
@@ -35,7 +47,22 @@ class CountersIncrementKafkaConsumer : public infra::kafka::Consumer {
   void processOne(const RdKafka::Message& msg, void* opaque) override;
 
  private:
+  // Approximate memory taken by one aggregated count besides its key
+  static constexpr int64_t kCountEntryOverheadBytes = 64;
+
+  // Write the aggregated counts together with the offset of the last processed message, and clear them
+  void commitCounts(std::unordered_map<std::string, int64_t>* counts);
+
   int64_t lastProcessedOffset_;
+  int64_t lastCommittedOffset_;
+  // How far behind the head of the log the last processed message was, based on its timestamp; 0 once caught up
+  int64_t lastLagMs_;
+  // Approximate memory taken by the counts aggregated in the current batch
+  int64_t countsBytes_;
+  CountersMemory::ConsumerBuffer buffer_;
+  CountersCatchUpMode catchUp_;
+  CountersBackpressure backpressure_;
+  CountersGroupCommit::Participant groupCommitParticipant_;
 };
 
 }  // namespace counters
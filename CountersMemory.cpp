@@ -0,0 +1,162 @@
+#include "counters/CountersMemory.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <utility>
+
+#include "counters/CountersMetrics.h"
+#include "gflags/gflags.h"
+#include "glog/logging.h"
+
+DEFINE_int64(counters_memory_budget_mb, 0,
+             "Total memory budget for the block cache, memtables, index/filter blocks and consumer buffers; 0 leaves "
+             "them unbounded, with a separate block cache of the default size per column family");
+DEFINE_int32(counters_memtable_budget_percent, 25, "Share of the memory budget that memtables may use");
+DEFINE_int32(counters_consumer_buffer_budget_percent, 10, "Share of the memory budget that consumer buffers may use");
+
+namespace counters {
+
+std::mutex CountersMemory::mutex_;
+std::unordered_map<std::string, int64_t> CountersMemory::consumerBufferBytes_;
+std::vector<std::weak_ptr<rocksdb::Cache>> CountersMemory::blockCaches_;
+
+// Consumer buffers are reported whenever they changed by this much, or were emptied
+static constexpr int64_t kConsumerBufferReportBytes = 1024 * 1024;
+
+static int64_t budgetBytes() {
+  return FLAGS_counters_memory_budget_mb * 1024 * 1024;
+}
+
+CountersMemory::ConsumerBuffer::ConsumerBuffer(std::string consumerName)
+    : consumerName_(std::move(consumerName)), reportedBytes_(0), overBudget_(false) {
+  setConsumerBufferBytes(consumerName_, 0);
+}
+
+CountersMemory::ConsumerBuffer::~ConsumerBuffer() {
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    consumerBufferBytes_.erase(consumerName_);
+  }
+  CountersMetrics::set("memory.consumer_buffers." + consumerName_, 0);
+}
+
+bool CountersMemory::ConsumerBuffer::update(int64_t bytes) {
+  if (bytes != 0 && std::abs(bytes - reportedBytes_) < kConsumerBufferReportBytes) return overBudget_;
+  setConsumerBufferBytes(consumerName_, bytes);
+  reportedBytes_ = bytes;
+  overBudget_ = bytes > 0 && bytes >= consumerBufferFairShareBytes() && consumerBuffersOverBudget();
+  return overBudget_;
+}
+
+std::shared_ptr<rocksdb::Cache> CountersMemory::blockCache(int defaultBlockCacheSizeMb) {
+  if (hasBudget()) return sharedBlockCache();
+
+  size_t capacity = static_cast<size_t>(defaultBlockCacheSizeMb) * 1024 * 1024;
+  std::shared_ptr<rocksdb::Cache> cache = rocksdb::NewLRUCache(capacity);
+  std::lock_guard<std::mutex> guard(mutex_);
+  blockCaches_.push_back(cache);
+  return cache;
+}
+
+std::shared_ptr<rocksdb::Cache> CountersMemory::sharedBlockCache() {
+  static std::shared_ptr<rocksdb::Cache> cache = []() {
+    size_t capacity = static_cast<size_t>(blockCacheBudgetBytes());
+    LOG(INFO) << "Shared block cache capacity is " << capacity / 1024 / 1024 << "MB";
+    std::shared_ptr<rocksdb::Cache> cache = rocksdb::NewLRUCache(capacity);
+    std::lock_guard<std::mutex> guard(mutex_);
+    blockCaches_.push_back(cache);
+    return cache;
+  }();
+  return cache;
+}
+
+std::shared_ptr<rocksdb::WriteBufferManager> CountersMemory::writeBufferManager() {
+  if (!hasBudget()) return nullptr;
+  static std::shared_ptr<rocksdb::WriteBufferManager> manager =
+      std::make_shared<rocksdb::WriteBufferManager>(static_cast<size_t>(memtableBudgetBytes()), sharedBlockCache());
+  return manager;
+}
+
+bool CountersMemory::hasBudget() {
+  return FLAGS_counters_memory_budget_mb > 0;
+}
+
+int64_t CountersMemory::blockCacheBudgetBytes() {
+  // everything but the consumers' share
+  return budgetBytes() - consumerBufferBudgetBytes();
+}
+
+int64_t CountersMemory::memtableBudgetBytes() {
+  return budgetBytes() * FLAGS_counters_memtable_budget_percent / 100;
+}
+
+int64_t CountersMemory::consumerBufferBudgetBytes() {
+  return budgetBytes() * FLAGS_counters_consumer_buffer_budget_percent / 100;
+}
+
+void CountersMemory::setConsumerBufferBytes(const std::string& consumerName, int64_t bytes) {
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    consumerBufferBytes_[consumerName] = bytes;
+  }
+  CountersMetrics::set("memory.consumer_buffers." + consumerName, bytes);
+}
+
+bool CountersMemory::consumerBuffersOverBudget() {
+  return hasBudget() && consumerBufferBytes() > consumerBufferBudgetBytes();
+}
+
+int64_t CountersMemory::consumerBufferFairShareBytes() {
+  size_t numConsumers = 0;
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    numConsumers = std::max<size_t>(consumerBufferBytes_.size(), 1);
+  }
+  return consumerBufferBudgetBytes() / static_cast<int64_t>(numConsumers);
+}
+
+int64_t CountersMemory::consumerBufferBytes() {
+  std::lock_guard<std::mutex> guard(mutex_);
+  int64_t total = 0;
+  for (const auto& entry : consumerBufferBytes_) {
+    total += entry.second;
+  }
+  return total;
+}
+
+std::vector<std::pair<std::string, int64_t>> CountersMemory::report(rocksdb::DB* db) {
+  std::vector<std::pair<std::string, int64_t>> result;
+  int64_t capacity = 0;
+  int64_t usage = 0;
+  int64_t pinnedUsage = 0;
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    blockCaches_.erase(std::remove_if(blockCaches_.begin(), blockCaches_.end(),
+                                      [](const std::weak_ptr<rocksdb::Cache>& cache) { return cache.expired(); }),
+                       blockCaches_.end());
+    for (const auto& weakCache : blockCaches_) {
+      std::shared_ptr<rocksdb::Cache> cache = weakCache.lock();
+      if (!cache) continue;
+      capacity += cache->GetCapacity();
+      usage += cache->GetUsage();
+      pinnedUsage += cache->GetPinnedUsage();
+    }
+  }
+  result.emplace_back("block_cache.capacity", capacity);
+  result.emplace_back("block_cache.usage", usage);
+  result.emplace_back("block_cache.pinned_usage", pinnedUsage);
+
+  uint64_t value = 0;
+  result.emplace_back("memtables", db->GetIntProperty("rocksdb.cur-size-all-mem-tables", &value) ? value : 0);
+  // index and filter blocks held outside of the block cache
+  value = 0;
+  result.emplace_back("table_readers", db->GetIntProperty("rocksdb.estimate-table-readers-mem", &value) ? value : 0);
+
+  std::shared_ptr<rocksdb::WriteBufferManager> manager = writeBufferManager();
+  result.emplace_back("write_buffer_manager.usage", manager ? manager->memory_usage() : 0);
+  result.emplace_back("consumer_buffers", consumerBufferBytes());
+  result.emplace_back("budget", budgetBytes());
+  return result;
+}
+
+}  // namespace counters
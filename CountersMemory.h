@@ -0,0 +1,77 @@
+#ifndef COUNTERS_COUNTERSMEMORY_H_
+#define COUNTERS_COUNTERSMEMORY_H_
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "rocksdb/cache.h"
+#include "rocksdb/db.h"
+#include "rocksdb/write_buffer_manager.h"
+
+namespace counters {
+
+// Accounts for the memory of the block cache, memtables, table readers and consumer buffers, and splits an optional
+// global budget between them. Under a budget, memtables and index/filter blocks are charged to the block cache so
+// that RocksDB stays within the cache capacity, and consumers stop growing their buffers once their share is used.
+class CountersMemory {
+ public:
+  // Block cache for a column family. Under a budget, all column families share one cache sized from the budget;
+  // otherwise each gets its own cache of defaultBlockCacheSizeMb.
+  static std::shared_ptr<rocksdb::Cache> blockCache(int defaultBlockCacheSizeMb);
+
+  // Write buffer manager charging memtables to the shared block cache, or null without a budget
+  static std::shared_ptr<rocksdb::WriteBufferManager> writeBufferManager();
+
+  static bool hasBudget();
+
+  // Split of the budget, in bytes. Memtables are charged to the block cache, so its capacity includes their share.
+  static int64_t blockCacheBudgetBytes();
+  static int64_t memtableBudgetBytes();
+  static int64_t consumerBufferBudgetBytes();
+
+  // Bytes buffered by one consumer. Changes are reported in coarse steps, so that updating it per message stays cheap.
+  class ConsumerBuffer {
+   public:
+    explicit ConsumerBuffer(std::string consumerName);
+    ~ConsumerBuffer();
+
+    // Set the bytes currently buffered and return whether this consumer should write out what it has buffered
+    // instead of reading more: consumers together are over their share of the budget, and this one holds at least
+    // its fair part of that share. A consumer well within its part never flushes on behalf of the others.
+    bool update(int64_t bytes);
+
+   private:
+    const std::string consumerName_;
+    int64_t reportedBytes_;
+    bool overBudget_;
+  };
+
+  // Record how many bytes a consumer currently buffers
+  static void setConsumerBufferBytes(const std::string& consumerName, int64_t bytes);
+
+  // Whether consumers together buffer more than their share of the budget
+  static bool consumerBuffersOverBudget();
+
+  // Fair part of the consumers' share of the budget for each consumer currently buffering
+  static int64_t consumerBufferFairShareBytes();
+
+  // Memory use by component, in bytes
+  static std::vector<std::pair<std::string, int64_t>> report(rocksdb::DB* db);
+
+ private:
+  static int64_t consumerBufferBytes();
+  static std::shared_ptr<rocksdb::Cache> sharedBlockCache();
+
+  static std::mutex mutex_;
+  static std::unordered_map<std::string, int64_t> consumerBufferBytes_;
+  // Block caches handed out, for reporting; they go away with the column families using them
+  static std::vector<std::weak_ptr<rocksdb::Cache>> blockCaches_;
+};
+
+}  // namespace counters
+
+#endif  // COUNTERS_COUNTERSMEMORY_H_
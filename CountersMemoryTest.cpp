@@ -0,0 +1,123 @@
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "counters/CountersHandler.h"
+#include "counters/CountersMemory.h"
+#include "counters/CountersMetrics.h"
+#include "gflags/gflags.h"
+#include "gtest/gtest.h"
+#include "rocksdb/cache.h"
+#include "stesting/TestWithRocksDb.h"
+
+DECLARE_int64(counters_memory_budget_mb);
+DECLARE_int32(counters_memtable_budget_percent);
+DECLARE_int32(counters_consumer_buffer_budget_percent);
+
+namespace counters {
+
+class CountersMemoryTest : public stesting::TestWithRocksDb {
+ protected:
+  CountersMemoryTest()
+    : stesting::TestWithRocksDb({}, {{"default", CountersHandler::optimizeColumnFamily}}) {}
+
+  ~CountersMemoryTest() {
+    FLAGS_counters_memory_budget_mb = 0;
+  }
+
+  std::map<std::string, int64_t> report() {
+    std::vector<std::pair<std::string, int64_t>> entries = CountersMemory::report(db());
+    return std::map<std::string, int64_t>(entries.begin(), entries.end());
+  }
+
+  static constexpr int64_t kMb = 1024 * 1024;
+};
+
+constexpr int64_t CountersMemoryTest::kMb;
+
+TEST_F(CountersMemoryTest, BudgetSplit) {
+  FLAGS_counters_memory_budget_mb = 100;
+  FLAGS_counters_memtable_budget_percent = 25;
+  FLAGS_counters_consumer_buffer_budget_percent = 10;
+  EXPECT_TRUE(CountersMemory::hasBudget());
+  // memtables are charged to the block cache, so it gets everything but the consumers' share
+  EXPECT_EQ(90 * kMb, CountersMemory::blockCacheBudgetBytes());
+  EXPECT_EQ(25 * kMb, CountersMemory::memtableBudgetBytes());
+  EXPECT_EQ(10 * kMb, CountersMemory::consumerBufferBudgetBytes());
+
+  FLAGS_counters_memory_budget_mb = 0;
+  EXPECT_FALSE(CountersMemory::hasBudget());
+  EXPECT_EQ(nullptr, CountersMemory::writeBufferManager());
+}
+
+TEST_F(CountersMemoryTest, Report) {
+  int64_t capacity = report()["block_cache.capacity"];
+  {
+    // without a budget, every column family gets a cache of its own
+    std::shared_ptr<rocksdb::Cache> cache1 = CountersMemory::blockCache(8);
+    std::shared_ptr<rocksdb::Cache> cache2 = CountersMemory::blockCache(8);
+    EXPECT_NE(cache1, cache2);
+    EXPECT_EQ(capacity + 16 * kMb, report()["block_cache.capacity"]);
+  }
+  // and its cache stops counting once the column family is gone
+  EXPECT_EQ(capacity, report()["block_cache.capacity"]);
+
+  CountersMemory::ConsumerBuffer buffer("consumer1");
+  buffer.update(2 * kMb);
+  std::map<std::string, int64_t> entries = report();
+  EXPECT_EQ(2 * kMb, entries["consumer_buffers"]);
+  EXPECT_EQ(0, entries["budget"]);
+  EXPECT_EQ(0, entries["write_buffer_manager.usage"]);
+  EXPECT_TRUE(entries.count("memtables"));
+  EXPECT_TRUE(entries.count("table_readers"));
+}
+
+TEST_F(CountersMemoryTest, ConsumerBuffersOverBudget) {
+  // consumers may buffer 10MB together
+  FLAGS_counters_memory_budget_mb = 100;
+  FLAGS_counters_consumer_buffer_budget_percent = 10;
+
+  CountersMemory::ConsumerBuffer buffer1("consumer1");
+  EXPECT_FALSE(buffer1.update(6 * kMb));
+  EXPECT_EQ(6 * kMb, CountersMetrics::get("memory.consumer_buffers.consumer1"));
+  {
+    CountersMemory::ConsumerBuffer buffer2("consumer2");
+    EXPECT_TRUE(buffer2.update(6 * kMb));
+    // small changes are not reported
+    EXPECT_TRUE(buffer2.update(6 * kMb - 1));
+    EXPECT_EQ(6 * kMb, CountersMetrics::get("memory.consumer_buffers.consumer2"));
+    EXPECT_FALSE(buffer2.update(0));
+    EXPECT_TRUE(buffer2.update(6 * kMb));
+  }
+  // a consumer going away no longer counts
+  EXPECT_FALSE(buffer1.update(7 * kMb));
+
+  // without a budget, consumers buffer as much as they like
+  FLAGS_counters_memory_budget_mb = 0;
+  EXPECT_FALSE(buffer1.update(100 * kMb));
+}
+
+TEST_F(CountersMemoryTest, OnlyConsumersOverTheirFairShareFlush) {
+  // consumers may buffer 10MB together, 5MB each
+  FLAGS_counters_memory_budget_mb = 100;
+  FLAGS_counters_consumer_buffer_budget_percent = 10;
+
+  CountersMemory::ConsumerBuffer buffer1("consumer1");
+  CountersMemory::ConsumerBuffer buffer2("consumer2");
+  EXPECT_EQ(5 * kMb, CountersMemory::consumerBufferFairShareBytes());
+  EXPECT_TRUE(buffer2.update(20 * kMb));
+  EXPECT_TRUE(CountersMemory::consumerBuffersOverBudget());
+
+  // the other consumer stays over budget, but a small buffer does not have to be written out for it
+  EXPECT_FALSE(buffer1.update(100));
+  EXPECT_FALSE(buffer1.update(2 * kMb));
+  EXPECT_FALSE(buffer1.update(0));
+  EXPECT_FALSE(buffer1.update(2 * kMb));
+  // only once it grows past its own part
+  EXPECT_TRUE(buffer1.update(6 * kMb));
+  EXPECT_FALSE(buffer1.update(0));
+}
+
+}  // namespace counters
@@ -0,0 +1,29 @@
+#include "counters/CountersMetrics.h"
+
+namespace counters {
+
+std::mutex CountersMetrics::mutex_;
+std::map<std::string, int64_t> CountersMetrics::gauges_;
+
+void CountersMetrics::set(const std::string& name, int64_t value) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  gauges_[name] = value;
+}
+
+void CountersMetrics::add(const std::string& name, int64_t delta) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  gauges_[name] += delta;
+}
+
+int64_t CountersMetrics::get(const std::string& name) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  auto it = gauges_.find(name);
+  return it == gauges_.end() ? 0 : it->second;
+}
+
+std::map<std::string, int64_t> CountersMetrics::snapshot() {
+  std::lock_guard<std::mutex> guard(mutex_);
+  return gauges_;
+}
+
+}  // namespace counters
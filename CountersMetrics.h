@@ -0,0 +1,27 @@
+#ifndef COUNTERS_COUNTERSMETRICS_H_
+#define COUNTERS_COUNTERSMETRICS_H_
+
+#include <map>
+#include <mutex>
+#include <string>
+
+namespace counters {
+
+// Process-wide named gauges reported through the METRICS command
+class CountersMetrics {
+ public:
+  static void set(const std::string& name, int64_t value);
+  static void add(const std::string& name, int64_t delta);
+  static int64_t get(const std::string& name);
+
+  // All gauges ordered by name
+  static std::map<std::string, int64_t> snapshot();
+
+ private:
+  static std::mutex mutex_;
+  static std::map<std::string, int64_t> gauges_;
+};
+
+}  // namespace counters
+
+#endif  // COUNTERS_COUNTERSMETRICS_H_
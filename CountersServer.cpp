@@ -3,15 +3,28 @@
 
 #include "counters/CountersDecrementKafkaStoreConsumer.h"
 #include "counters/CountersHandler.h"
+#include "counters/CountersHotKeys.h"
 #include "counters/CountersIncrementKafkaConsumer.h"
+#include "gflags/gflags.h"
 #include "pipeline/RedisPipelineBootstrap.h"
 #include "platform/gcloud/GoogleCloudStorage.h"
 
+DEFINE_int32(counters_executor_shards, 0,
+             "Number of key-sharded executors running redis commands off the IO threads; 0 runs commands inline");
+
 namespace counters {
 
 static pipeline::RedisPipelineBootstrap::Config config{
   redisHandlerFactory : [](pipeline::RedisPipelineBootstrap* bootstrap) -> std::shared_ptr<pipeline::RedisHandler> {
-    return std::make_shared<CountersHandler>(bootstrap->getDatabaseManager(), bootstrap->getKafkaConsumerHelper());
+    // Shared by all connections, created after flags are parsed
+    static std::shared_ptr<CountersCommandExecutor> executor =
+        FLAGS_counters_executor_shards > 0
+            ? std::make_shared<CountersCommandExecutor>(static_cast<size_t>(FLAGS_counters_executor_shards))
+            : nullptr;
+    // Warm up the block cache when the first connection comes in, unless a consumer started it already
+    CountersHotKeys::instance()->start(bootstrap->getDatabaseManager()->db());
+    return std::make_shared<CountersHandler>(bootstrap->getDatabaseManager(), bootstrap->getKafkaConsumerHelper(),
+                                             executor);
   },
 
   kafkaConsumerFactoryMap :
@@ -20,9 +33,11 @@ static pipeline::RedisPipelineBootstrap::Config config{
            [](const std::string& brokerList, const pipeline::KafkaConsumerConfig& consumerConfig,
               const std::string& offsetKey,
               pipeline::RedisPipelineBootstrap* bootstrap) -> std::shared_ptr<infra::kafka::AbstractConsumer> {
+             // consumers are created at startup, so begin warming up the block cache right away
+             CountersHotKeys::instance()->start(bootstrap->getDatabaseManager()->db());
              return std::make_shared<CountersIncrementKafkaConsumer>(
                  brokerList, consumerConfig.topic, consumerConfig.partition, consumerConfig.groupId, offsetKey,
-                 consumerConfig.lowLatency, bootstrap->getKafkaConsumerHelper());
+                 consumerConfig.lowLatency, bootstrap->getKafkaConsumerHelper(), bootstrap->getDatabaseManager()->db());
            },
        },
        {
@@ -34,7 +49,7 @@ static pipeline::RedisPipelineBootstrap::Config config{
                  brokerList, consumerConfig.objectStoreBucketName, consumerConfig.objectStoreObjectNamePrefix,
                  consumerConfig.topic, consumerConfig.partition, consumerConfig.groupId, offsetKey,
                  consumerConfig.offsetKeySuffix, bootstrap->getKafkaConsumerHelper(),
-                 std::make_shared<platform::gcloud::GoogleCloudStorage>());
+                 std::make_shared<platform::gcloud::GoogleCloudStorage>(), bootstrap->getDatabaseManager()->db());
            },
        }},
 
@@ -48,7 +63,7 @@ static pipeline::RedisPipelineBootstrap::Config config{
       },
   },
 
-  rocksDbConfigurator : nullptr,
+  rocksDbConfigurator : CountersHandler::optimizeDatabase,
 
   singletonRedisHandler : false,  // in order to support transactions
 };
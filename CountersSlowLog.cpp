@@ -0,0 +1,101 @@
+#include "counters/CountersSlowLog.h"
+
+#include <algorithm>
+
+#include "counters/IncrbyMergeOperator.h"
+#include "gflags/gflags.h"
+#include "rocksdb/iostats_context.h"
+#include "rocksdb/perf_context.h"
+#include "rocksdb/perf_level.h"
+
+DEFINE_int32(counters_slowlog_sample_rate, 0, "Profile one in this many commands for the slow log; 0 disables it");
+DEFINE_int64(counters_slowlog_threshold_us, 10000, "Sampled commands taking at least this long enter the slow log");
+DEFINE_int32(counters_slowlog_max_len, 128, "Maximum number of entries kept in the slow log");
+
+namespace counters {
+
+constexpr size_t CountersSlowLog::kMaxArgs;
+constexpr size_t CountersSlowLog::kMaxArgLength;
+
+CountersSlowLog::Sample::Sample(const std::vector<std::string>& cmd) : cmd_(cmd), sampled_(false) {
+  if (FLAGS_counters_slowlog_sample_rate <= 0) return;
+  static thread_local uint64_t commandCount = 0;
+  if (++commandCount % FLAGS_counters_slowlog_sample_rate != 0) return;
+
+  sampled_ = true;
+  rocksdb::SetPerfLevel(rocksdb::PerfLevel::kEnableTimeExceptForMutex);
+  rocksdb::get_perf_context()->Reset();
+  rocksdb::get_iostats_context()->Reset();
+  startMergeCount_ = IncrbyMergeOperator::threadMergeCount();
+  start_ = std::chrono::steady_clock::now();
+}
+
+CountersSlowLog::Sample::~Sample() {
+  if (!sampled_) return;
+  int64_t durationUs =
+      std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start_).count();
+  rocksdb::SetPerfLevel(rocksdb::PerfLevel::kDisable);
+  if (durationUs < FLAGS_counters_slowlog_threshold_us) return;
+
+  const rocksdb::PerfContext* perf = rocksdb::get_perf_context();
+  const rocksdb::IOStatsContext* iostats = rocksdb::get_iostats_context();
+  Entry entry;
+  entry.timestampMs =
+      std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch())
+          .count();
+  entry.durationUs = durationUs;
+  for (size_t i = 0; i < std::min(cmd_.size(), kMaxArgs); i++) {
+    entry.cmd.push_back(cmd_[i].substr(0, kMaxArgLength));
+  }
+  entry.stats = {
+      {"merge_operands", IncrbyMergeOperator::threadMergeCount() - startMergeCount_},
+      {"merge_operator_time_ns", perf->merge_operator_time_nanos},
+      {"get_from_memtable_count", perf->get_from_memtable_count},
+      {"get_from_memtable_time_ns", perf->get_from_memtable_time},
+      {"get_from_output_files_time_ns", perf->get_from_output_files_time},
+      {"bloom_memtable_hit_count", perf->bloom_memtable_hit_count},
+      {"bloom_memtable_miss_count", perf->bloom_memtable_miss_count},
+      {"bloom_sst_hit_count", perf->bloom_sst_hit_count},
+      {"bloom_sst_miss_count", perf->bloom_sst_miss_count},
+      {"block_cache_hit_count", perf->block_cache_hit_count},
+      {"block_read_count", perf->block_read_count},
+      {"block_read_bytes", perf->block_read_byte},
+      {"block_read_time_ns", perf->block_read_time},
+      {"write_wal_time_ns", perf->write_wal_time},
+      {"write_memtable_time_ns", perf->write_memtable_time},
+      {"io_bytes_read", iostats->bytes_read},
+      {"io_read_time_ns", iostats->read_nanos},
+  };
+  CountersSlowLog::instance()->add(std::move(entry));
+}
+
+CountersSlowLog* CountersSlowLog::instance() {
+  static CountersSlowLog slowLog;
+  return &slowLog;
+}
+
+void CountersSlowLog::add(Entry entry) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  entry.id = nextId_++;
+  entries_.push_front(std::move(entry));
+  while (entries_.size() > static_cast<size_t>(std::max(FLAGS_counters_slowlog_max_len, 0))) {
+    entries_.pop_back();
+  }
+}
+
+std::vector<CountersSlowLog::Entry> CountersSlowLog::get(size_t count) const {
+  std::lock_guard<std::mutex> guard(mutex_);
+  return std::vector<Entry>(entries_.begin(), entries_.begin() + std::min(count, entries_.size()));
+}
+
+size_t CountersSlowLog::len() const {
+  std::lock_guard<std::mutex> guard(mutex_);
+  return entries_.size();
+}
+
+void CountersSlowLog::reset() {
+  std::lock_guard<std::mutex> guard(mutex_);
+  entries_.clear();
+}
+
+}  // namespace counters
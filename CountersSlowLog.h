@@ -0,0 +1,58 @@
+#ifndef COUNTERS_COUNTERSSLOWLOG_H_
+#define COUNTERS_COUNTERSSLOWLOG_H_
+
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace counters {
+
+// A bounded log of sampled commands that ran over a latency threshold, with the RocksDB perf context and IO stats
+// breakdown captured while they ran. Sampling is off by default and then costs a single thread-local increment.
+class CountersSlowLog {
+ public:
+  struct Entry {
+    int64_t id;
+    int64_t timestampMs;
+    int64_t durationUs;
+    std::vector<std::string> cmd;
+    // name -> value pairs from perf context, IO stats and the merge operator
+    std::vector<std::pair<std::string, uint64_t>> stats;
+  };
+
+  // Profiles a command when it is picked by sampling and records it on destruction if it was slow
+  class Sample {
+   public:
+    explicit Sample(const std::vector<std::string>& cmd);
+    ~Sample();
+
+   private:
+    const std::vector<std::string>& cmd_;
+    bool sampled_;
+    std::chrono::steady_clock::time_point start_;
+    uint64_t startMergeCount_;
+  };
+
+  static CountersSlowLog* instance();
+
+  void add(Entry entry);
+  // Up to count entries, newest first
+  std::vector<Entry> get(size_t count) const;
+  size_t len() const;
+  void reset();
+
+ private:
+  static constexpr size_t kMaxArgs = 32;
+  static constexpr size_t kMaxArgLength = 128;
+
+  mutable std::mutex mutex_;
+  std::deque<Entry> entries_;
+  int64_t nextId_ = 0;
+};
+
+}  // namespace counters
+
+#endif  // COUNTERS_COUNTERSSLOWLOG_H_
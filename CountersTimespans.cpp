@@ -1,29 +1,98 @@
 #include "counters/CountersTimespans.h"
 
-#include <chrono>
+#include <algorithm>
+
+#include "boost/algorithm/string/predicate.hpp"
+#include "folly/Conv.h"
+#include "folly/String.h"
+#include "gflags/gflags.h"
+#include "glog/logging.h"
+
+DEFINE_string(counters_timespans,
+              "hour:H:3600000:0,day:D:86400000:1,week:W:604800000:2,month:M:2592000000:3,total:T:-1:4,"
+              "2days:D2:172800000:5,2weeks:W2:1209600000:6,8days:D8:691200000:7,6months:M6:15552000000:8",
+              "Comma-separated mode:suffix:delayMs:bit timespans, where a delay of -1 never expires");
+DEFINE_string(counters_default_timespans, "hour,day,week,month",
+              "Comma-separated modes for records without flags. Decrements resolve them again when they expire, so "
+              "changing them corrupts counters incremented before the change until its longest window has passed");
+DEFINE_string(counters_prefix_timespans, "",
+              "Semicolon-separated prefix=mode,mode entries overriding the default timespans for keys starting with "
+              "prefix, longest prefix first. Like --counters_default_timespans, these must not change for as long as "
+              "the longest window they select");
 
 namespace counters {
 
-using milliseconds = std::chrono::milliseconds;
-using hours = std::chrono::hours;
-
-const std::unordered_map<std::string, CountersTimespans::Timespan> CountersTimespans::kTimespanMap =
-    []() -> std::unordered_map<std::string, CountersTimespans::Timespan> {
-  return {
-      {"hour", {std::chrono::duration_cast<milliseconds>(hours(1)).count(), "H", 1L}},
-      {"day", {std::chrono::duration_cast<milliseconds>(hours(24)).count(), "D", 2L}},
-      {"week", {std::chrono::duration_cast<milliseconds>(hours(24 * 7)).count(), "W", 4L}},
-      {"month", {std::chrono::duration_cast<milliseconds>(hours(24 * 30)).count(), "M", 8L}},
-      {"total", {-1L, "T", 16L}},
-      {"2days", {std::chrono::duration_cast<milliseconds>(hours(24 * 2)).count(), "D2", 32L}},
-      {"2weeks", {std::chrono::duration_cast<milliseconds>(hours(24 * 14)).count(), "W2", 64L}},
-      {"8days", {std::chrono::duration_cast<milliseconds>(hours(24 * 8)).count(), "D8", 128L}},
-      {"6months", {std::chrono::duration_cast<milliseconds>(hours(24 * 180)).count(), "M6", 256L}},
-  };
-}();
-
-const int64_t CountersTimespans::kDefaultTimespanFlags =
-    CountersTimespans::kTimespanMap.at("hour").mask | CountersTimespans::kTimespanMap.at("day").mask |
-    CountersTimespans::kTimespanMap.at("week").mask | CountersTimespans::kTimespanMap.at("month").mask;
+constexpr size_t CountersTimespans::kMaxTimespans;
+
+const CountersTimespans& CountersTimespans::instance() {
+  static const CountersTimespans timespans(FLAGS_counters_timespans, FLAGS_counters_default_timespans,
+                                           FLAGS_counters_prefix_timespans);
+  return timespans;
+}
+
+CountersTimespans::CountersTimespans(const std::string& timespansSpec, const std::string& defaultSpec,
+                                     const std::string& prefixSpec) {
+  std::vector<std::string> entries;
+  folly::split(',', timespansSpec, entries, true);
+  for (const auto& entry : entries) {
+    std::vector<std::string> fields;
+    folly::split(':', entry, fields);
+    CHECK_EQ(fields.size(), 4UL) << "Invalid timespan: " << entry;
+    size_t bit = folly::to<size_t>(fields[3]);
+    CHECK_LT(bit, kMaxTimespans) << "Invalid timespan bit: " << entry;
+    CHECK_EQ(timespans_[bit].mask, 0) << "Duplicate timespan bit: " << entry;
+    CHECK(find(fields[0]) == nullptr) << "Duplicate timespan mode: " << entry;
+    for (const auto& timespan : timespans_) {
+      CHECK(!timespan.mask || timespan.keySuffix != fields[1]) << "Duplicate timespan suffix: " << entry;
+    }
+    timespans_[bit] = Timespan(folly::to<int64_t>(fields[2]), fields[1], static_cast<int64_t>(1ULL << bit), fields[0]);
+  }
+
+  defaultFlags_ = parseModes(defaultSpec);
+
+  entries.clear();
+  folly::split(';', prefixSpec, entries, true);
+  for (const auto& entry : entries) {
+    std::string prefix;
+    std::string modes;
+    CHECK(folly::split('=', entry, prefix, modes)) << "Invalid prefix timespans: " << entry;
+    prefixFlags_.emplace_back(prefix, parseModes(modes));
+  }
+  std::sort(prefixFlags_.begin(), prefixFlags_.end(),
+            [](const std::pair<std::string, int64_t>& lhs, const std::pair<std::string, int64_t>& rhs) {
+              return lhs.first.size() > rhs.first.size();
+            });
+}
+
+const CountersTimespans::Timespan* CountersTimespans::find(const std::string& mode) const {
+  for (const auto& timespan : timespans_) {
+    if (timespan.mask && timespan.mode == mode) {
+      return &timespan;
+    }
+  }
+  return nullptr;
+}
+
+int64_t CountersTimespans::resolveFlags(const std::string& key, int64_t flags) const {
+  if (flags) return flags;
+  for (const auto& entry : prefixFlags_) {
+    if (boost::starts_with(key, entry.first)) {
+      return entry.second;
+    }
+  }
+  return defaultFlags_;
+}
+
+int64_t CountersTimespans::parseModes(const std::string& modes) const {
+  std::vector<std::string> names;
+  folly::split(',', modes, names, true);
+  int64_t mask = 0;
+  for (const auto& name : names) {
+    const Timespan* timespan = find(name);
+    CHECK(timespan != nullptr) << "Unknown mode: " << name;
+    mask |= timespan->mask;
+  }
+  return mask;
+}
 
 }  // namespace counters
@@ -1,27 +1,68 @@
 #ifndef COUNTERS_COUNTERSTIMESPANS_H_
 #define COUNTERS_COUNTERSTIMESPANS_H_
 
+#include <array>
 #include <string>
-#include <unordered_map>
 #include <utility>
+#include <vector>
 
 namespace counters {
 
+// Registry of the timespans counters are kept for. Each timespan owns one bit of the flags carried by counter records
+// and is looked up by bit position. The set of timespans, their key suffixes and the flags used for records without
+// flags are configured per deployment, and the default flags may be overridden per key prefix so that key families
+// only pay for the windows they need.
 class CountersTimespans {
  public:
   struct Timespan {
     int64_t timeDelayMs;
     std::string keySuffix;
     int64_t mask;
-    Timespan() : timeDelayMs(-1), keySuffix(), mask(0) {}
+    std::string mode;
+    Timespan() : timeDelayMs(-1), keySuffix(), mask(0), mode() {}
 
-    Timespan(int64_t _timeDelayMs, std::string _keySuffix, int64_t _mask)
-        : timeDelayMs(_timeDelayMs), keySuffix(std::move(_keySuffix)), mask(_mask) {}
+    Timespan(int64_t _timeDelayMs, std::string _keySuffix, int64_t _mask, std::string _mode)
+        : timeDelayMs(_timeDelayMs), keySuffix(std::move(_keySuffix)), mask(_mask), mode(std::move(_mode)) {}
   };
 
-  // Mode -> Timespan
-  static const std::unordered_map<std::string, Timespan> kTimespanMap;
-  static const int64_t kDefaultTimespanFlags;
+  // One timespan per bit of the int64 flags
+  static constexpr size_t kMaxTimespans = 64;
+
+  // Registry configured by --counters_timespans, --counters_default_timespans and --counters_prefix_timespans
+  static const CountersTimespans& instance();
+
+  // timespansSpec: comma-separated mode:suffix:delayMs:bit entries, where a delay of -1 never expires
+  // defaultSpec: comma-separated modes used for records without flags
+  // prefixSpec: semicolon-separated prefix=mode,mode entries overriding defaultSpec for keys starting with prefix
+  CountersTimespans(const std::string& timespansSpec, const std::string& defaultSpec, const std::string& prefixSpec);
+
+  // Timespan of mode, or null if there is none
+  const Timespan* find(const std::string& mode) const;
+
+  // Flags to apply for a record on key, resolving zero flags to the defaults of the key's family. Decrements resolve
+  // them again once they expire, so the defaults must stay the same for as long as the longest window they select.
+  int64_t resolveFlags(const std::string& key, int64_t flags) const;
+
+  // Call func on every timespan selected by flags for key in bit order
+  template <typename Func>
+  void forEachTimespan(const std::string& key, int64_t flags, Func func) const {
+    for (uint64_t remaining = static_cast<uint64_t>(resolveFlags(key, flags)); remaining; remaining &= remaining - 1) {
+      const Timespan& timespan = timespans_[__builtin_ctzll(remaining)];
+      if (timespan.mask) {
+        func(timespan);
+      }
+    }
+  }
+
+ private:
+  // Mask of a comma-separated list of modes
+  int64_t parseModes(const std::string& modes) const;
+
+  // Indexed by bit position, with a zero mask where no timespan is configured
+  std::array<Timespan, kMaxTimespans> timespans_;
+  int64_t defaultFlags_;
+  // Longest prefix first
+  std::vector<std::pair<std::string, int64_t>> prefixFlags_;
 };
 
 }  // namespace counters
@@ -0,0 +1,38 @@
+#include <string>
+#include <vector>
+
+#include "counters/CountersTimespans.h"
+#include "gtest/gtest.h"
+
+namespace counters {
+
+TEST(CountersTimespansTest, PrefixDefaults) {
+  CountersTimespans timespans("hour:H:3600000:0,day:D:86400000:1,total:T:-1:4", "hour,day", "a=total;ab=hour");
+
+  const CountersTimespans::Timespan* day = timespans.find("day");
+  ASSERT_NE(nullptr, day);
+  EXPECT_EQ("D", day->keySuffix);
+  EXPECT_EQ(2, day->mask);
+  EXPECT_EQ(nullptr, timespans.find("week"));
+
+  // explicit flags always win, otherwise the longest matching prefix picks the defaults
+  EXPECT_EQ(2, timespans.resolveFlags("abc", 2));
+  EXPECT_EQ(1, timespans.resolveFlags("abc", 0));
+  EXPECT_EQ(16, timespans.resolveFlags("acb", 0));
+  EXPECT_EQ(3, timespans.resolveFlags("bca", 0));
+
+  std::vector<std::string> suffixes;
+  timespans.forEachTimespan("bca", 0x17, [&suffixes](const CountersTimespans::Timespan& timespan) {
+    suffixes.push_back(timespan.keySuffix);
+  });
+  EXPECT_EQ(std::vector<std::string>({ "H", "D", "T" }), suffixes);
+}
+
+TEST(CountersTimespansTest, RejectsDuplicates) {
+  EXPECT_DEATH(CountersTimespans("hour:H:3600000:0,day:D:86400000:0", "", ""), "Duplicate timespan bit");
+  EXPECT_DEATH(CountersTimespans("hour:H:3600000:0,hour:D:86400000:1", "", ""), "Duplicate timespan mode");
+  // two timespans writing the same keys would double count and expire each other's increments
+  EXPECT_DEATH(CountersTimespans("hour:H:3600000:0,day:H:86400000:1", "", ""), "Duplicate timespan suffix");
+}
+
+}  // namespace counters
@@ -0,0 +1,8 @@
+#include "counters/CountersValue.h"
+
+DEFINE_bool(counters_compact_value_encoding, false,
+            "Write counter values and merge operands as zigzag varints instead of fixed 8-byte integers. Both formats "
+            "are always readable, and compactions rewrite values into the format selected here. To downgrade to a "
+            "binary that only reads fixed values, restart with this off and run a full manual compaction of every "
+            "column family, which flushes memtables and rewrites all values and merge operands as fixed, before "
+            "switching binaries.");
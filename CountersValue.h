@@ -0,0 +1,86 @@
+#ifndef COUNTERS_COUNTERSVALUE_H_
+#define COUNTERS_COUNTERSVALUE_H_
+
+#include <string>
+
+#include "boost/endian/buffers.hpp"
+#include "gflags/gflags.h"
+#include "rocksdb/slice.h"
+
+DECLARE_bool(counters_compact_value_encoding);
+
+namespace counters {
+
+// Counter values and merge operands are stored either as fixed 8-byte big-endian integers, the original format, or
+// as a version byte followed by a zigzag varint, which takes 2 bytes for small counts and deltas such as +1/-1.
+// Both formats are always readable so that a database migrates incrementally once compact encoding is turned on.
+class CountersValue {
+ public:
+  static constexpr char kVarintVersion = 0x01;
+  // version byte and up to 10 varint bytes
+  static constexpr size_t kMaxEncodedSize = 11;
+
+  static void encode(int64_t value, std::string* out) {
+    if (FLAGS_counters_compact_value_encoding) {
+      char buf[kMaxEncodedSize];
+      size_t size = encodeVarint(value, buf);
+      // A compact value of 8 bytes would be indistinguishable from the fixed format
+      if (size != sizeof(int64_t)) {
+        out->assign(buf, size);
+        return;
+      }
+    }
+    boost::endian::big_int64_buf_t buf(value);
+    out->assign(buf.data(), sizeof(int64_t));
+  }
+
+  static std::string encode(int64_t value) {
+    std::string out;
+    encode(value, &out);
+    return out;
+  }
+
+  // Return false when data is in neither format
+  static bool decode(const rocksdb::Slice& data, int64_t* value) {
+    if (data.size() == sizeof(int64_t)) {
+      *value = boost::endian::detail::load_big_endian<int64_t, sizeof(int64_t)>(data.data());
+      return true;
+    }
+    if (data.size() < 2 || data.size() > kMaxEncodedSize || data[0] != kVarintVersion) {
+      return false;
+    }
+    uint64_t zigzag = 0;
+    for (size_t i = 1; i < data.size(); i++) {
+      uint8_t byte = static_cast<uint8_t>(data[i]);
+      zigzag |= static_cast<uint64_t>(byte & 0x7f) << (7 * (i - 1));
+      if (!(byte & 0x80)) {
+        if (i + 1 != data.size()) return false;
+        *value = static_cast<int64_t>((zigzag >> 1) ^ (0 - (zigzag & 1)));
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Whether data is stored in the original fixed format
+  static bool isFixed(const rocksdb::Slice& data) {
+    return data.size() == sizeof(int64_t);
+  }
+
+ private:
+  static size_t encodeVarint(int64_t value, char* buf) {
+    uint64_t zigzag = (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+    size_t size = 0;
+    buf[size++] = kVarintVersion;
+    while (zigzag >= 0x80) {
+      buf[size++] = static_cast<char>(zigzag | 0x80);
+      zigzag >>= 7;
+    }
+    buf[size++] = static_cast<char>(zigzag);
+    return size;
+  }
+};
+
+}  // namespace counters
+
+#endif  // COUNTERS_COUNTERSVALUE_H_
@@ -3,13 +3,12 @@
 
 #include <string>
 
-#include "boost/endian/buffers.hpp"
+#include "counters/CountersValue.h"
 #include "glog/logging.h"
 #include "rocksdb/merge_operator.h"
 
 namespace counters {
 
-using boost::endian::detail::load_big_endian;
 class IncrbyMergeOperator : public rocksdb::AssociativeMergeOperator {
  public:
   virtual ~IncrbyMergeOperator() {}
@@ -18,15 +17,14 @@ class IncrbyMergeOperator : public rocksdb::AssociativeMergeOperator {
              std::string* new_value, rocksdb::Logger* logger) const override {
     int64_t intExistingValue = 0;
     if (existing_value) {
-      CHECK_EQ(existing_value->size(), sizeof(int64_t));
-      intExistingValue = load_big_endian<int64_t, sizeof(int64_t)>(existing_value->data());
+      CHECK(CountersValue::decode(*existing_value, &intExistingValue));
     }
 
-    CHECK_EQ(value.size(), sizeof(int64_t));
-    int64_t intValue = load_big_endian<int64_t, sizeof(int64_t)>(value.data());
+    int64_t intValue = 0;
+    CHECK(CountersValue::decode(value, &intValue));
 
-    boost::endian::big_int64_buf_t newValueBuf(intExistingValue + intValue);
-    new_value->assign(newValueBuf.data(), sizeof(int64_t));
+    CountersValue::encode(intExistingValue + intValue, new_value);
+    threadMergeCount()++;
 
     return true;
   }
@@ -34,6 +32,12 @@ class IncrbyMergeOperator : public rocksdb::AssociativeMergeOperator {
   const char* Name() const override {
     return "CountersIncrbyMergeOperator";
   }
+
+  // Number of operands merged on the calling thread, used to profile commands
+  static uint64_t& threadMergeCount() {
+    static thread_local uint64_t count = 0;
+    return count;
+  }
 };
 
 }  // namespace counters
@@ -3,7 +3,8 @@
 
 #include <string>
 
-#include "boost/endian/buffers.hpp"
+#include "counters/CountersValue.h"
+#include "glog/logging.h"
 #include "rocksdb/compaction_filter.h"
 #include "rocksdb/slice.h"
 
@@ -16,8 +17,13 @@ class ZeroValueCompactionFilter : public rocksdb::CompactionFilter {
   bool Filter(int level, const rocksdb::Slice& key, const rocksdb::Slice& existing_value, std::string* new_value,
               bool* value_changed) const override {
     *value_changed = false;
-    CHECK_EQ(existing_value.size(), sizeof(int64_t));
-    int64_t intValue = boost::endian::detail::load_big_endian<int64_t, sizeof(int64_t)>(existing_value.data());
+    int64_t intValue = 0;
+    CHECK(CountersValue::decode(existing_value, &intValue));
+    if (intValue != 0 && CountersValue::isFixed(existing_value) == FLAGS_counters_compact_value_encoding) {
+      // migrate values to the format currently written as compactions rewrite them, in either direction
+      CountersValue::encode(intValue, new_value);
+      *value_changed = true;
+    }
     // delete the key when value is zero
     return intValue == 0;
   }